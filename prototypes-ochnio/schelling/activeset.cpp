@@ -0,0 +1,53 @@
+#include "activeset.h"
+
+#include <algorithm>
+
+ActiveSet
+ActiveSet::Create(V2<size_t> dimensions)
+{
+    return {
+        .dimensions = dimensions,
+        .marked = std::vector<u8>(dimensions.x * dimensions.y, 0),
+    };
+}
+
+void ActiveSet::MarkAll()
+{
+    std::fill(marked.begin(), marked.end(), 1);
+
+    marks.resize(marked.size());
+    for (size_t i = 0; i < marks.size(); i++)
+    {
+        marks[i] = (u32)i;
+    }
+}
+
+void ActiveSet::Take(std::vector<u32>* out)
+{
+    out->clear();
+
+    // Many marks, a linear scan beats sorting them
+    if (marks.size() > marked.size() / 16)
+    {
+        for (size_t i = 0; i < marked.size(); i++)
+        {
+            if (marked[i])
+            {
+                out->push_back((u32)i);
+                marked[i] = 0;
+            }
+        }
+
+        marks.clear();
+        return;
+    }
+
+    std::sort(marks.begin(), marks.end());
+    for (u32 index : marks)
+    {
+        marked[index] = 0;
+    }
+
+    out->swap(marks);
+    marks.clear();
+}
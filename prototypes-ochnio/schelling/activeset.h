@@ -0,0 +1,71 @@
+#pragma once
+
+#include <vector>
+#include <cassert>
+#include <algorithm>
+
+#include "gametypes.h"
+#include "math.h"
+
+
+// Furthest a move can change someone's decision: a cell next to a
+// candidate destination changes that candidate's score
+constexpr i32 gInfluenceRadius = 2;
+
+// Cells whose inhabitant has to be evaluated next turn. An inhabitant
+// that found no better cell keeps finding none until something within
+// gInfluenceRadius of it changes, so only those get marked.
+struct ActiveSet
+{
+    V2<size_t> dimensions = {};
+
+    // Per cell, set while the cell is in marks
+    std::vector<u8> marked = {};
+
+    // Marked cells, in marking order
+    std::vector<u32> marks = {};
+
+    static
+    ActiveSet Create(V2<size_t> dimensions);
+
+    inline
+    void Mark(size_t index)
+    {
+        if (marked[index])
+        {
+            return;
+        }
+
+        marked[index] = 1;
+        marks.push_back((u32)index);
+    }
+
+    // Marks every cell within gInfluenceRadius steps of position
+    inline
+    void MarkAround(V2<i32> position)
+    {
+        for (i32 dy = -gInfluenceRadius; dy <= gInfluenceRadius; dy++)
+        {
+            i32 y = position.y + dy;
+            if (y < 0 || y >= (i32)dimensions.y)
+            {
+                continue;
+            }
+
+            i32 reach = gInfluenceRadius - (dy < 0 ? -dy : dy);
+            i32 xBegin = std::max(position.x - reach, 0);
+            i32 xEnd = std::min(position.x + reach + 1, (i32)dimensions.x);
+
+            for (i32 x = xBegin; x < xEnd; x++)
+            {
+                Mark(y * dimensions.x + x);
+            }
+        }
+    }
+
+    void MarkAll();
+
+    // Moves the marked cells into out in row major order, the order a
+    // full sweep visits them, and leaves the set empty
+    void Take(std::vector<u32>* out);
+};
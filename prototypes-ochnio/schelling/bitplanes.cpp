@@ -0,0 +1,117 @@
+#include "bitplanes.h"
+
+#include <array>
+#include <bit>
+#include <cstring>
+
+// Lanes are stored as the bytes of a u64
+static_assert(std::endian::native == std::endian::little);
+
+// Byte b spread out so bit i of b is the low bit of byte i
+static constexpr std::array<u64, 256> gSpreadBits = []
+{
+    std::array<u64, 256> table = {};
+    for (u64 b = 0; b < 256; b++)
+    for (u64 bit = 0; bit < 8; bit++)
+    {
+        table[b] |= ((b >> bit) & 1) << (bit * 8);
+    }
+    return table;
+}();
+
+// Eight lanes of a bit sliced count as eight bytes
+static inline u64 SpreadCount(BitSlicedCount count, i32 shift)
+{
+    return gSpreadBits[(count.bit0 >> shift) & 0xff]
+         + (gSpreadBits[(count.bit1 >> shift) & 0xff] << 1)
+         + (gSpreadBits[(count.bit2 >> shift) & 0xff] << 2);
+}
+
+BitPlaneGrid
+BitPlaneGrid::Create(V2<size_t> dimensions, size_t archetypeCount)
+{
+    assert(archetypeCount <= gMaxBitPlaneArchetypes);
+
+    size_t wordsPerRow = (dimensions.x + 63) / 64;
+
+    return {
+        .dimensions = dimensions,
+        .archetypeCount = archetypeCount,
+        .wordsPerRow = wordsPerRow,
+        .bits = std::vector<u64>((archetypeCount + 1)
+                                 * dimensions.y * wordsPerRow, 0),
+    };
+}
+
+void BitPlaneGrid::NetWord(i32 y, i32 word, u8* out)
+{
+    BitSlicedCount total = CountWord(OccupancyPlane(), y, word);
+
+    // Eight lanes per u64, one byte each. Counts are at most 4, so
+    // 2 * same + bias - total stays within a byte and never borrows
+    u64 totals[8];
+    for (int i = 0; i < 8; i++)
+    {
+        totals[i] = SpreadCount(total, i * 8);
+    }
+
+    constexpr u64 bias = 0x0101010101010101ull * gNetBias;
+
+    for (size_t a = 0; a < archetypeCount; a++)
+    {
+        BitSlicedCount same = CountWord(a, y, word);
+
+        for (int i = 0; i < 8; i++)
+        {
+            u64 lanes = (SpreadCount(same, i * 8) << 1) + bias - totals[i];
+            memcpy(out + a * 64 + i * 8, &lanes, sizeof(lanes));
+        }
+    }
+}
+
+BitPlaneRowScores
+BitPlaneRowScores::Create(BitPlaneGrid* planes)
+{
+    return {
+        .archetypeCount = planes->archetypeCount,
+        .wordsPerRow = planes->wordsPerRow,
+        .wordEnd = (i32)planes->wordsPerRow,
+        .scores = std::vector<u8>(3 * planes->wordsPerRow
+                                  * planes->archetypeCount * 64, 0),
+    };
+}
+
+void BitPlaneRowScores::Reset(i32 begin, i32 end)
+{
+    wordBegin = std::max(begin, 0);
+    wordEnd = std::min(end, (i32)wordsPerRow);
+
+    rows[0] = rows[1] = rows[2] = i32Min;
+}
+
+void BitPlaneRowScores::Prepare(BitPlaneGrid* planes, i32 y)
+{
+    for (i32 row = y - 1; row <= y + 1; row++)
+    {
+        i32 slot = (row + 3) % 3;
+        if (rows[slot] == row)
+        {
+            continue;
+        }
+
+        rows[slot] = row;
+
+        // Rows outside the grid are never scored
+        if (row < 0 || row >= (i32)planes->dimensions.y)
+        {
+            continue;
+        }
+
+        for (i32 word = wordBegin; word < wordEnd; word++)
+        {
+            u8* out = &scores[(slot * wordsPerRow + word)
+                              * archetypeCount * 64];
+            planes->NetWord(row, word, out);
+        }
+    }
+}
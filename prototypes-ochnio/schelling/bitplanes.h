@@ -0,0 +1,194 @@
+#pragma once
+
+#include <vector>
+#include <cassert>
+#include <bit>
+
+#include "gametypes.h"
+#include "math.h"
+#include "inhabitantstore.h"
+
+
+constexpr size_t gMaxBitPlaneArchetypes = 8;
+
+// Per lane count of set neighbours for 64 cells, bit sliced:
+// lane i holds bit0 + 2 * bit1 + 4 * bit2, at most 4
+struct BitSlicedCount
+{
+    u64 bit0 = 0;
+    u64 bit1 = 0;
+    u64 bit2 = 0;
+};
+
+// One bit per cell and archetype plus an occupancy plane. Rows are padded
+// to whole u64 words, unused lanes stay zero.
+struct BitPlaneGrid
+{
+    V2<size_t> dimensions = {};
+    size_t archetypeCount = 0;
+    size_t wordsPerRow = 0;
+
+    // planeCount() planes of dimensions.y rows of wordsPerRow words
+    std::vector<u64> bits = {};
+
+    static
+    BitPlaneGrid Create(V2<size_t> dimensions, size_t archetypeCount);
+
+    // The occupancy plane comes after the archetype planes
+    inline
+    size_t OccupancyPlane()
+    {
+        return archetypeCount;
+    }
+
+    inline
+    size_t PlaneCount()
+    {
+        return archetypeCount + 1;
+    }
+
+    inline
+    u64* Row(size_t plane, i32 y)
+    {
+        return &bits[(plane * dimensions.y + y) * wordsPerRow];
+    }
+
+    inline
+    u64 WordAt(size_t plane, i32 y, i32 word)
+    {
+        if (y < 0 || y >= (i32)dimensions.y
+            || word < 0 || word >= (i32)wordsPerRow)
+        {
+            return 0;
+        }
+        return Row(plane, y)[word];
+    }
+
+    inline
+    bool BitAt(size_t plane, i32 x, i32 y)
+    {
+        if (x < 0 || x >= (i32)dimensions.x)
+        {
+            return false;
+        }
+        return (WordAt(plane, y, x >> 6) >> (x & 63)) & 1;
+    }
+
+    inline
+    void Set(V2<i32> position, ArchetypeIndex archetype)
+    {
+        u64 mask = 1ull << (position.x & 63);
+        Row(archetype, position.y)[position.x >> 6] |= mask;
+        Row(OccupancyPlane(), position.y)[position.x >> 6] |= mask;
+    }
+
+    inline
+    void Clear(V2<i32> position, ArchetypeIndex archetype)
+    {
+        u64 mask = ~(1ull << (position.x & 63));
+        Row(archetype, position.y)[position.x >> 6] &= mask;
+        Row(OccupancyPlane(), position.y)[position.x >> 6] &= mask;
+    }
+
+    // Set neighbours of a single cell, the four bits gathered and popcounted
+    inline
+    i32 CountAt(size_t plane, i32 x, i32 y)
+    {
+        u32 gathered = (u32)BitAt(plane, x, y + 1)
+                     | (u32)BitAt(plane, x, y - 1) << 1
+                     | (u32)BitAt(plane, x + 1, y) << 2
+                     | (u32)BitAt(plane, x - 1, y) << 3;
+        return std::popcount(gathered);
+    }
+
+    // Same kind neighbours minus other neighbours of a cell, the score
+    // before the intolerance factor
+    inline
+    i32 NetAt(ArchetypeIndex archetype, i32 x, i32 y)
+    {
+        return 2 * CountAt(archetype, x, y) - CountAt(OccupancyPlane(), x, y);
+    }
+
+    // Set neighbours of the 64 cells of one row word at once:
+    // the four shifted neighbour words summed with bit sliced adders
+    inline
+    BitSlicedCount CountWord(size_t plane, i32 y, i32 word)
+    {
+        u64 centre = WordAt(plane, y, word);
+
+        u64 up = WordAt(plane, y + 1, word);
+        u64 down = WordAt(plane, y - 1, word);
+        u64 left = (centre << 1) | (WordAt(plane, y, word - 1) >> 63);
+        u64 right = (centre >> 1) | (WordAt(plane, y, word + 1) << 63);
+
+        u64 sumA = up ^ down;
+        u64 carryA = up & down;
+        u64 sumB = left ^ right;
+        u64 carryB = left & right;
+
+        u64 carryAB = sumA & sumB;
+
+        // carryAB can only be set when carryA and carryB are both clear
+        return {
+            .bit0 = sumA ^ sumB,
+            .bit1 = carryA ^ carryB ^ carryAB,
+            .bit2 = carryA & carryB,
+        };
+    }
+
+    // Net scores of the 64 cells of one row word, for every archetype.
+    // Stored biased by gNetBias so they fit a u8: out[a * 64 + lane]
+    void NetWord(i32 y, i32 word, u8* out);
+};
+
+// Added to every net score held in BitPlaneRowScores
+constexpr i32 gNetBias = 4;
+
+// Net scores of three consecutive rows for every archetype, filled a word
+// at a time while a row major walk goes down the grid. Each row is
+// computed once per walk. Only the words in [wordBegin, wordEnd) are
+// filled, so a tile doesn't pay for the whole row.
+struct BitPlaneRowScores
+{
+    size_t archetypeCount = 0;
+    size_t wordsPerRow = 0;
+
+    i32 wordBegin = 0;
+    i32 wordEnd = 0;
+
+    // Row held by each of the three slots
+    i32 rows[3] = { i32Min, i32Min, i32Min };
+
+    // [slot][word][archetype][lane], biased by gNetBias
+    std::vector<u8> scores = {};
+
+    static
+    BitPlaneRowScores Create(BitPlaneGrid* planes);
+
+    // Forget every row, following Prepare calls fill only the given words
+    void Reset(i32 wordBegin, i32 wordEnd);
+
+    // Makes rows y - 1 to y + 1 available, reusing what's already there
+    void Prepare(BitPlaneGrid* planes, i32 y);
+
+    inline
+    bool HoldsColumn(i32 x)
+    {
+        i32 word = x >> 6;
+        return x >= 0 && word >= wordBegin && word < wordEnd;
+    }
+
+    inline
+    i32 NetAt(ArchetypeIndex archetype, i32 x, i32 y)
+    {
+        i32 slot = (y + 3) % 3;
+        i32 word = x >> 6;
+
+        assert(rows[slot] == y);
+        assert(word >= wordBegin && word < wordEnd);
+
+        size_t index = ((slot * wordsPerRow + word) * archetypeCount
+                        + archetype) * 64 + (x & 63);
+        return (i32)scores[index] - gNetBias;
+    }
+};
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <vector>
+#include <cassert>
+#include <limits>
+
+#include "gametypes.h"
+
+
+constexpr u32 InvalidSlot = std::numeric_limits<u32>::max();
+
+// Set of cell indices with O(1) insert, remove and uniform sampling.
+// Members are kept densely packed, removal swaps the last member into
+// the hole, and every cell remembers its slot in the packed array.
+struct CellSet
+{
+    std::vector<u32> members = {};
+
+    // Per cell, InvalidSlot when not a member
+    std::vector<u32> slotOf = {};
+
+    static
+    CellSet Create(size_t cellCount)
+    {
+        return {
+            .slotOf = std::vector<u32>(cellCount, InvalidSlot),
+        };
+    }
+
+    inline
+    size_t Count()
+    {
+        return members.size();
+    }
+
+    inline
+    bool Contains(u32 cell)
+    {
+        return slotOf[cell] != InvalidSlot;
+    }
+
+    inline
+    void Insert(u32 cell)
+    {
+        assert(!Contains(cell));
+
+        slotOf[cell] = members.size();
+        members.push_back(cell);
+    }
+
+    inline
+    void Remove(u32 cell)
+    {
+        assert(Contains(cell));
+
+        u32 slot = slotOf[cell];
+        u32 last = members.back();
+
+        members[slot] = last;
+        slotOf[last] = slot;
+
+        members.pop_back();
+        slotOf[cell] = InvalidSlot;
+    }
+
+    // Puts the members in the given order, which has to hold every
+    // member exactly once. False otherwise, leaving the set broken
+    inline
+    bool Reorder(const u32* order, size_t count)
+    {
+        if (count != members.size())
+        {
+            return false;
+        }
+
+        // Taken out as they're seen, a repeat or a stranger isn't there
+        for (size_t i = 0; i < count; i++)
+        {
+            if (order[i] >= slotOf.size() || !Contains(order[i]))
+            {
+                return false;
+            }
+            slotOf[order[i]] = InvalidSlot;
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            members[i] = order[i];
+            slotOf[order[i]] = i;
+        }
+        return true;
+    }
+
+    // Uniformly picked member for a uniformly distributed random
+    inline
+    u32 Sample(u64 random)
+    {
+        assert(Count() > 0);
+        return members[random % members.size()];
+    }
+};
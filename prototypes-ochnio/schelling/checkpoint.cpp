@@ -0,0 +1,581 @@
+#include "checkpoint.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Arrays are written and read back byte for byte
+static_assert(std::is_trivially_copyable_v<GroundTile>);
+static_assert(std::is_trivially_copyable_v<InhabitantCell>);
+static_assert(std::is_trivially_copyable_v<InhabitantArchetype>);
+static_assert(std::is_trivially_copyable_v<CheckpointHeader>);
+
+static u64 AlignUp(u64 value)
+{
+    return (value + gCheckpointAlignment - 1) & ~(gCheckpointAlignment - 1);
+}
+
+// Big copies split into chunks spread over the system's threads
+static void ParallelCopy(InhabitantSystem* system,
+                         void* destination,
+                         const void* source,
+                         size_t bytes)
+{
+    constexpr size_t chunk = 4 << 20;
+
+    system->ParallelFor((bytes + chunk - 1) / chunk, [&](size_t i, u32)
+    {
+        size_t begin = i * chunk;
+        memcpy((u8*)destination + begin,
+               (const u8*)source + begin,
+               std::min(chunk, bytes - begin));
+    });
+}
+
+// Unallocated chunks are written out as fill, every chunk keeps its
+// place in the section. Cells inside a chunk are stored row major
+// whatever the grid's layout
+template<typename T, typename Layout>
+static bool WriteChunks(FILE* file, const ChunkedGrid<T, Layout>& grid)
+{
+    constexpr bool rowMajor = std::is_same_v<Layout, RowMajorLayout>;
+
+    std::vector<T> fillChunk(gChunkCells, grid.fill);
+    std::vector<T> reordered(rowMajor ? 0 : gChunkCells);
+
+    for (size_t chunk = 0; chunk < grid.ChunkCount(); chunk++)
+    {
+        const T* data = grid.ChunkData(chunk);
+        if (!data)
+        {
+            data = fillChunk.data();
+        }
+        else if (!rowMajor)
+        {
+            for (size_t y = 0; y < gChunkSize; y++)
+            for (size_t x = 0; x < gChunkSize; x++)
+            {
+                reordered[RowMajorLayout::Offset(x, y)] =
+                                            data[Layout::Offset(x, y)];
+            }
+            data = reordered.data();
+        }
+
+        if (fwrite(data, sizeof(T), gChunkCells, file) != gChunkCells)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Chunks that hold nothing but fill stay unallocated. Paged grids get
+// here on one thread, ParallelFor runs inline on a paged system
+template<typename T, typename Layout>
+static void ReadChunks(InhabitantSystem* system,
+                       ChunkedGrid<T, Layout>* grid,
+                       const T* source)
+{
+    constexpr bool rowMajor = std::is_same_v<Layout, RowMajorLayout>;
+
+    std::vector<T> fillChunk(gChunkCells, grid->fill);
+    size_t chunkBytes = gChunkCells * sizeof(T);
+
+    system->ParallelFor(grid->ChunkCount(), [&](size_t chunk, u32)
+    {
+        const T* data = source + chunk * gChunkCells;
+        if (memcmp(data, fillChunk.data(), chunkBytes) == 0)
+        {
+            return;
+        }
+
+        T* destination = grid->WritableChunk(chunk);
+        if (rowMajor)
+        {
+            memcpy(destination, data, chunkBytes);
+            return;
+        }
+
+        for (size_t y = 0; y < gChunkSize; y++)
+        for (size_t x = 0; x < gChunkSize; x++)
+        {
+            destination[Layout::Offset(x, y)] =
+                                    data[RowMajorLayout::Offset(x, y)];
+        }
+    });
+}
+
+// A paged store's columns go out a chunk of ids at a time, in the same
+// sections as the in memory columns
+static bool WritePagedColumn(FILE* file,
+                             InhabitantStore* store,
+                             ECheckpointSection section)
+{
+    size_t count = store->Count();
+    for (size_t first = 0; first < count; first += gPagedIds)
+    {
+        PagedColumns columns = store->ChunkColumns(first >> gPagedIdShift,
+                                                   false);
+        size_t n = std::min(gPagedIds, count - first);
+
+        bool written =
+            section == ECheckpointSection::InhabitantType
+                ? fwrite(columns.archetype, sizeof(ArchetypeIndex), n, file)
+                        == n
+                : fwrite(section == ECheckpointSection::InhabitantX
+                            ? columns.x : columns.y, sizeof(u16), n, file)
+                        == n;
+        if (!written)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void ReadPagedColumns(InhabitantStore* store,
+                             const ArchetypeIndex* archetypes,
+                             const u16* xs,
+                             const u16* ys)
+{
+    size_t count = store->Count();
+    for (size_t first = 0; first < count; first += gPagedIds)
+    {
+        PagedColumns columns = store->ChunkColumns(first >> gPagedIdShift,
+                                                   true);
+        size_t n = std::min(gPagedIds, count - first);
+
+        memcpy(columns.archetype, archetypes + first,
+               n * sizeof(ArchetypeIndex));
+        memcpy(columns.x, xs + first, n * sizeof(u16));
+        memcpy(columns.y, ys + first, n * sizeof(u16));
+    }
+}
+
+// Everything RebuildFromCells and the renderer index with is in range:
+// tile types, cell ids, archetypes, and every inhabitant stands in the
+// cell holding its id. Checked before anything is derived from them
+static bool ValidState(InhabitantSystem* system,
+                       const World& world,
+                       size_t archetypeCount)
+{
+    InhabitantStore& store = system->inhabitants;
+
+    size_t width = system->dimensions.x;
+    size_t height = system->dimensions.y;
+    size_t count = store.Count();
+
+    std::vector<u8> rowValid(height, 1);
+
+    system->ParallelFor(height, [&](size_t y, u32)
+    {
+        for (size_t x = 0; x < width; x++)
+        {
+            if ((size_t)world.GetTile(x, y).tileType
+                    >= (size_t)ETileTypes::Count)
+            {
+                rowValid[y] = 0;
+                return;
+            }
+
+            InhabitantCell cell = system->CellAt(x, y);
+            if (cell.IsEmpty())
+            {
+                continue;
+            }
+
+            size_t id = cell.Id();
+            if (id >= count
+                || store.PositionOf(id).x != (i32)x
+                || store.PositionOf(id).y != (i32)y)
+            {
+                rowValid[y] = 0;
+                return;
+            }
+        }
+    });
+
+    constexpr size_t sliceIds = 1 << 16;
+    size_t slices = (count + sliceIds - 1) / sliceIds;
+    std::vector<u8> sliceValid(slices, 1);
+
+    system->ParallelFor(slices, [&](size_t slice, u32)
+    {
+        size_t end = std::min(count, (slice + 1) * sliceIds);
+        for (size_t id = slice * sliceIds; id < end; id++)
+        {
+            V2<i32> position = store.PositionOf(id);
+            if (store.ArchetypeOf(id) >= archetypeCount
+                || (size_t)position.x >= width || (size_t)position.y >= height
+                || system->CellAt(position.x, position.y).Id()
+                        != (InhabitantID)id)
+            {
+                sliceValid[slice] = 0;
+                return;
+            }
+        }
+    });
+
+    return std::find(rowValid.begin(), rowValid.end(), 0) == rowValid.end()
+        && std::find(sliceValid.begin(), sliceValid.end(), 0)
+                == sliceValid.end();
+}
+
+bool Checkpoint::Save(const char* path, SimulationContext* context)
+{
+    InhabitantSystem& system = context->inhabitants;
+    InhabitantStore& store = system.inhabitants;
+    const World& world = *context->world;
+
+    assert(!system.turnInProgress);
+
+    CheckpointHeader header = {
+        .version = gCheckpointVersion,
+        .headerSize = sizeof(CheckpointHeader),
+
+        .seed = system.seed,
+        .turnCount = system.turnCount,
+        .stateHash = system.stateHash,
+
+        .width = (u32)system.dimensions.x,
+        .height = (u32)system.dimensions.y,
+        .inhabitantCount = store.Count(),
+
+        .gMaxInhabitants = system.settings.gMaxInhabitants,
+        .gIntoleranceFactor = system.settings.gIntoleranceFactor,
+        .gHappinessThreshold = system.settings.gHappinessThreshold,
+        .movementMode = (u32)system.settings.movementMode,
+    };
+    memcpy(header.magic, gCheckpointMagic, sizeof(header.magic));
+
+    // Empty unless the movement mode keeps them
+    std::vector<u32> bucketSizes = {};
+    std::vector<u32> bucketCells = {};
+    for (const std::vector<u32>& bucket : system.vacancyIndex.buckets)
+    {
+        bucketSizes.push_back(bucket.size());
+        bucketCells.insert(bucketCells.end(), bucket.begin(), bucket.end());
+    }
+
+    struct
+    {
+        const void* data;
+        u64 size;
+    }
+    arrays[(size_t)ECheckpointSection::Count] =
+    {
+        // Chunked, written by WriteChunks
+        { nullptr, world.tiles.ChunkCount() * gChunkCells
+                                            * sizeof(GroundTile) },
+        { nullptr, system.cells.ChunkCount() * gChunkCells
+                                             * sizeof(InhabitantCell) },
+        { system.settings.archetypes.data(),
+          system.settings.archetypes.size() * sizeof(InhabitantArchetype) },
+        // Written by WritePagedColumn when paged
+        { store.archetype.data(), store.Count() * sizeof(ArchetypeIndex) },
+        { store.x.data(), store.Count() * sizeof(u16) },
+        { store.y.data(), store.Count() * sizeof(u16) },
+        { system.vacancies.members.data(),
+          system.vacancies.Count() * sizeof(u32) },
+        { bucketSizes.data(), bucketSizes.size() * sizeof(u32) },
+        { bucketCells.data(), bucketCells.size() * sizeof(u32) },
+    };
+
+    u64 offset = AlignUp(sizeof(CheckpointHeader));
+    for (size_t i = 0; i < (size_t)ECheckpointSection::Count; i++)
+    {
+        header.sections[i] = { .offset = offset, .size = arrays[i].size };
+        offset = AlignUp(offset + arrays[i].size);
+    }
+
+    // Written next to the target and renamed over it once complete, a
+    // crash never leaves a torn checkpoint behind
+    std::string temporary = std::string(path) + ".tmp";
+
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (!file)
+    {
+        fprintf(stderr, "can't write checkpoint %s\n", temporary.c_str());
+        return false;
+    }
+
+    static const u8 padding[gCheckpointAlignment] = {};
+
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    u64 written = sizeof(header);
+
+    for (size_t i = 0; ok && i < (size_t)ECheckpointSection::Count; i++)
+    {
+        u64 pad = header.sections[i].offset - written;
+        ok = fwrite(padding, 1, pad, file) == pad;
+
+        if (i == (size_t)ECheckpointSection::Tiles)
+        {
+            ok = ok && WriteChunks(file, world.tiles);
+        }
+        else if (i == (size_t)ECheckpointSection::Cells)
+        {
+            ok = ok && WriteChunks(file, system.cells);
+        }
+        else if (store.pager
+                 && (i == (size_t)ECheckpointSection::InhabitantType
+                     || i == (size_t)ECheckpointSection::InhabitantX
+                     || i == (size_t)ECheckpointSection::InhabitantY))
+        {
+            ok = ok && WritePagedColumn(file, &store,
+                                        (ECheckpointSection)i);
+        }
+        else
+        {
+            ok = ok && fwrite(arrays[i].data, 1, arrays[i].size, file)
+                                                        == arrays[i].size;
+        }
+        written += pad + arrays[i].size;
+    }
+
+    ok = (fclose(file) == 0) && ok;
+    ok = ok && rename(temporary.c_str(), path) == 0;
+
+    if (!ok)
+    {
+        fprintf(stderr, "failed writing checkpoint %s\n", path);
+        remove(temporary.c_str());
+    }
+
+    return ok;
+}
+
+bool CheckpointView::Map(const char* path, CheckpointView* view)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "can't open checkpoint %s\n", path);
+        return false;
+    }
+
+    struct stat info = {};
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(CheckpointHeader))
+    {
+        fprintf(stderr, "%s is too small to be a checkpoint\n", path);
+        close(fd);
+        return false;
+    }
+
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (data == MAP_FAILED)
+    {
+        fprintf(stderr, "can't map checkpoint %s\n", path);
+        return false;
+    }
+
+    view->data = (const u8*)data;
+    view->size = info.st_size;
+
+    const CheckpointHeader& header = view->Header();
+
+    bool valid = memcmp(header.magic, gCheckpointMagic,
+                        sizeof(header.magic)) == 0
+              && header.version == gCheckpointVersion
+              && header.headerSize == sizeof(CheckpointHeader);
+
+    for (size_t i = 0; valid && i < (size_t)ECheckpointSection::Count; i++)
+    {
+        CheckpointSection section = header.sections[i];
+        valid = section.offset % gCheckpointAlignment == 0
+             && section.offset <= view->size
+             && section.size <= view->size - section.offset;
+    }
+
+    if (!valid)
+    {
+        fprintf(stderr, "%s is not a version %u checkpoint\n",
+                path, gCheckpointVersion);
+        view->Unmap();
+        return false;
+    }
+
+    return true;
+}
+
+void CheckpointView::Unmap()
+{
+    if (data)
+    {
+        munmap((void*)data, size);
+    }
+
+    data = nullptr;
+    size = 0;
+}
+
+bool Checkpoint::Load(const char* path,
+                      const SimulationSettings& settings,
+                      SimulationContext* context)
+{
+    CheckpointView view = {};
+    if (!CheckpointView::Map(path, &view))
+    {
+        return false;
+    }
+
+    // Every byte gets read once, front to back
+    madvise((void*)view.data, view.size, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+    // A copy, the mapping goes away before we're done
+    CheckpointHeader header = view.Header();
+
+    size_t chunksPerRow = (header.width + gChunkSize - 1) >> gChunkShift;
+    size_t chunkedCells = chunksPerRow * chunksPerRow * gChunkCells;
+    size_t count = header.inhabitantCount;
+    size_t archetypeCount = view.SectionSize(ECheckpointSection::Archetypes)
+                          / sizeof(InhabitantArchetype);
+
+    using enum ECheckpointSection;
+
+    bool valid = header.width == header.height
+              && header.width <= gMaxWorldSize
+              && archetypeCount > 0 && archetypeCount <= gMaxArchetypes
+              && count <= gMaxCellInhabitants
+              && header.movementMode <= (u32)EMovementMode::BestVacancy
+              && view.SectionSize(Tiles) == chunkedCells * sizeof(GroundTile)
+              && view.SectionSize(Cells)
+                        == chunkedCells * sizeof(InhabitantCell)
+              && view.SectionSize(InhabitantType)
+                        == count * sizeof(ArchetypeIndex)
+              && view.SectionSize(InhabitantX) == count * sizeof(u16)
+              && view.SectionSize(InhabitantY) == count * sizeof(u16)
+              && view.SectionSize(Vacancies) % sizeof(u32) == 0
+              && view.SectionSize(VacancyBucketSizes) % sizeof(u32) == 0
+              && view.SectionSize(VacancyBucketCells) % sizeof(u32) == 0;
+
+    if (!valid)
+    {
+        fprintf(stderr, "%s has inconsistent sections\n", path);
+        view.Unmap();
+        return false;
+    }
+
+    SimulationSettings loaded = settings;
+    loaded.seed = header.seed;
+    loaded.world.size = header.width;
+
+    InhabitantsSettings& is = loaded.inhabitants;
+    is.size = header.width;
+    is.gMaxInhabitants = header.gMaxInhabitants;
+    is.gIntoleranceFactor = header.gIntoleranceFactor;
+    is.gHappinessThreshold = header.gHappinessThreshold;
+    is.movementMode = (EMovementMode)header.movementMode;
+
+    const InhabitantArchetype* archetypes =
+                        view.Section<InhabitantArchetype>(Archetypes);
+    is.archetypes.assign(archetypes, archetypes + archetypeCount);
+
+    if (!is.pageFile.empty() && !is.CanPage())
+    {
+        fprintf(stderr, "%s can't be paged, its movement jumps anywhere\n",
+                path);
+        view.Unmap();
+        return false;
+    }
+
+    InhabitantSystem system = InhabitantSystem::Create(is, loaded.seed);
+    InhabitantStore& store = system.inhabitants;
+
+    std::shared_ptr<World> world =
+                    std::make_shared<World>(World::Create(loaded.world));
+
+    if (!is.pageFile.empty()
+        && !world->Page(is.pageFile.c_str(), is.PagedCapacity()))
+    {
+        fprintf(stderr, "keeping terrain in memory\n");
+    }
+
+    store.Resize(count);
+
+    ReadChunks(&system, &world->tiles, view.Section<GroundTile>(Tiles));
+    ReadChunks(&system, &system.cells, view.Section<InhabitantCell>(Cells));
+    if (store.pager)
+    {
+        ReadPagedColumns(&store, view.Section<ArchetypeIndex>(InhabitantType),
+                         view.Section<u16>(InhabitantX),
+                         view.Section<u16>(InhabitantY));
+    }
+    else
+    {
+        ParallelCopy(&system, store.archetype.data(),
+                     view.Section<u8>(InhabitantType),
+                     view.SectionSize(InhabitantType));
+        ParallelCopy(&system, store.x.data(),
+                     view.Section<u8>(InhabitantX),
+                     view.SectionSize(InhabitantX));
+        ParallelCopy(&system, store.y.data(),
+                     view.Section<u8>(InhabitantY),
+                     view.SectionSize(InhabitantY));
+    }
+
+    // Checked against the rebuilt vacancies, copied until then
+    auto copyOf = [&](ECheckpointSection section)
+    {
+        const u32* data = view.Section<u32>(section);
+        return std::vector<u32>(data,
+                                data + view.SectionSize(section) / sizeof(u32));
+    };
+    std::vector<u32> vacancyOrder = copyOf(Vacancies);
+    std::vector<u32> bucketSizes = copyOf(VacancyBucketSizes);
+    std::vector<u32> bucketCells = copyOf(VacancyBucketCells);
+
+    view.Unmap();
+
+    if (!ValidState(&system, *world, archetypeCount))
+    {
+        fprintf(stderr, "%s holds state out of range\n", path);
+        return false;
+    }
+
+    system.turnCount = header.turnCount;
+    system.RebuildFromCells();
+
+    // The rebuild files vacancies row by row, the run had them in the
+    // order its moves left them
+    bool vacanciesMatch =
+        system.vacancies.Reorder(vacancyOrder.data(), vacancyOrder.size())
+        && bucketSizes.size() == system.vacancyIndex.buckets.size()
+        && system.vacancyIndex.Reorder(bucketSizes.data(),
+                                       bucketCells.data(),
+                                       bucketCells.size());
+
+    if (!vacanciesMatch)
+    {
+        fprintf(stderr, "%s holds vacancies that don't match its cells\n",
+                path);
+        return false;
+    }
+
+    // Cheap end to end check, every cell and archetype feeds the hash
+    if (system.stateHash != header.stateHash)
+    {
+        fprintf(stderr, "%s doesn't match its state hash\n", path);
+        return false;
+    }
+
+    *context = {
+        .settings = loaded,
+        .world = std::move(world),
+        .inhabitants = std::move(system),
+    };
+
+    return true;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "gametypes.h"
+#include "simulation.h"
+
+
+// Snapshot of a simulation between turns. The file is the header followed
+// by raw arrays, exactly as they sit in memory, each starting on a page
+// boundary. Mapping the file gives usable arrays with nothing to parse.
+//
+// Terrain and cells are stored chunk by chunk like ChunkedGrid, row
+// major inside a chunk whatever the grid's layout, unallocated chunks as
+// fill. Loading leaves chunks with nothing but fill unallocated.
+//
+// Only state is stored: terrain, cells, the inhabitant columns, the turn
+// and the seed. The generator is counter based, so seed and turn are
+// its whole state. Neighbour counts and the like are rebuilt on restore.
+// Vacancies are rebuilt too, but global and best vacancy movement pick
+// them by slot and the slots are in whatever order moves left them, so
+// that order is stored and put back. How to run (threads, backend,
+// update mode) is up to whoever restores.
+
+constexpr char gCheckpointMagic[8] = { 'S', 'C', 'H', 'E', 'L', 'C', 'K', 'P' };
+constexpr u32 gCheckpointVersion = 4;
+constexpr u64 gCheckpointAlignment = 4096;
+
+enum class ECheckpointSection
+{
+    Tiles = 0,          // GroundTile per world cell, chunk major
+    Cells,              // InhabitantCell per cell, chunk major
+    Archetypes,         // InhabitantArchetype per archetype
+    InhabitantType,     // ArchetypeIndex per inhabitant
+    InhabitantX,        // u16 per inhabitant
+    InhabitantY,        // u16 per inhabitant
+    Vacancies,          // u32 cell per CellSet member, global movement
+    VacancyBucketSizes, // u32 per VacancyIndex bucket, best vacancy
+    VacancyBucketCells, // u32 cell per bucket member, bucket by bucket
+    Count
+};
+
+struct CheckpointSection
+{
+    // From the start of the file, a multiple of gCheckpointAlignment
+    u64 offset = 0;
+    u64 size = 0;
+};
+
+struct CheckpointHeader
+{
+    char magic[8] = {};
+    u32 version = 0;
+    u32 headerSize = 0;
+
+    u64 seed = 0;
+    u64 turnCount = 0;
+    u64 stateHash = 0;
+
+    u32 width = 0;
+    u32 height = 0;
+    u64 inhabitantCount = 0;
+
+    // Parameters the stored state depends on
+    f32 gMaxInhabitants = 0.0f;
+    f32 gIntoleranceFactor = 0.0f;
+    f32 gHappinessThreshold = 0.0f;
+    u32 movementMode = 0;
+
+    CheckpointSection sections[(size_t)ECheckpointSection::Count] = {};
+};
+
+// Read only view of a mapped checkpoint, the arrays point straight into
+// the mapping
+struct CheckpointView
+{
+    const u8* data = nullptr;
+    size_t size = 0;
+
+    static
+    bool Map(const char* path, CheckpointView* view);
+
+    void Unmap();
+
+    inline
+    const CheckpointHeader& Header() const
+    {
+        return *(const CheckpointHeader*)data;
+    }
+
+    template<typename T>
+    const T* Section(ECheckpointSection section) const
+    {
+        return (const T*)(data + Header().sections[(size_t)section].offset);
+    }
+
+    inline
+    u64 SectionSize(ECheckpointSection section) const
+    {
+        return Header().sections[(size_t)section].size;
+    }
+};
+
+struct Checkpoint
+{
+    // The simulation must not be in the middle of a turn
+    static
+    bool Save(const char* path, SimulationContext* context);
+
+    // A context with the checkpoint's world, parameters and state, run
+    // with the threads, backend and modes of settings. Everything is
+    // range checked before anything is derived from it.
+    //
+    // The sections are copied out of the mapping rather than used in
+    // place: the simulation writes its cells and columns every turn, and
+    // cells live in chunks that may be laid out differently, left
+    // unallocated or paged to a file
+    static
+    bool Load(const char* path,
+              const SimulationSettings& settings,
+              SimulationContext* context);
+};
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <cassert>
+
+#include "gametypes.h"
+#include "math.h"
+#include "chunkpager.h"
+
+
+constexpr size_t gChunkShift = 6;
+constexpr size_t gChunkSize = 1 << gChunkShift;
+constexpr size_t gChunkCells = gChunkSize * gChunkSize;
+
+// Where a cell goes inside its chunk, x and y in [0, gChunkSize). A
+// layout is a struct with a static Offset and a name for tools to print.
+// Chunks themselves are always in row major order.
+struct RowMajorLayout
+{
+    static constexpr const char* name = "row major";
+
+    static inline
+    size_t Offset(size_t x, size_t y)
+    {
+        return (y << gChunkShift) | x;
+    }
+};
+
+// Bits of v moved apart to every other bit, v below gChunkSize
+constexpr u32 MortonSpread(u32 v)
+{
+    u32 spread = 0;
+    for (u32 bit = 0; bit < gChunkShift; bit++)
+    {
+        spread |= ((v >> bit) & 1) << (2 * bit);
+    }
+    return spread;
+}
+
+constexpr auto gMortonSpread = []
+{
+    std::array<u16, gChunkSize> table = {};
+    for (u32 v = 0; v < gChunkSize; v++)
+    {
+        table[v] = MortonSpread(v);
+    }
+    return table;
+}();
+
+// Z-order: x and y bits interleaved, so any 2^k x 2^k aligned square is
+// contiguous and the cells above and below are mostly close by. Together
+// with the chunks this is a tiled Morton layout
+struct MortonLayout
+{
+    static constexpr const char* name = "morton";
+
+    static inline
+    size_t Offset(size_t x, size_t y)
+    {
+        return gMortonSpread[x] | (gMortonSpread[y] << 1);
+    }
+};
+
+// Square grid stored as gChunkSize x gChunkSize chunks, each contiguous,
+// so a neighbourhood is a few cache lines and pages apart rather than
+// whole grid rows. Edge chunks are padded to full size. Inside a chunk
+// cells go by Layout.
+//
+// A chunk is only allocated on its first write, until then it reads as
+// fill. Writes from several threads have to go to different chunks, or
+// to chunks that are already allocated.
+//
+// Once paged (see Page) the chunks live in a file instead and only the
+// most recently used ones are in memory. A paged grid is for one thread
+// only, and a reference from At lasts until the next access, unless its
+// pager shares the chunks (see ChunkPager::Share).
+template<typename T, typename Layout = RowMajorLayout>
+struct ChunkedGrid
+{
+    V2<size_t> dimensions = {};
+    size_t chunksPerRow = 0;
+    size_t chunkRows = 0;
+
+    T fill = {};
+
+    // Empty until allocated, all empty once paged
+    std::vector<std::vector<T>> chunks = {};
+
+    std::shared_ptr<ChunkPager> pager = {};
+
+    static
+    ChunkedGrid Create(V2<size_t> dimensions, T fill = {})
+    {
+        size_t chunksPerRow = (dimensions.x + gChunkSize - 1) >> gChunkShift;
+        size_t chunkRows = (dimensions.y + gChunkSize - 1) >> gChunkShift;
+
+        return {
+            .dimensions = dimensions,
+            .chunksPerRow = chunksPerRow,
+            .chunkRows = chunkRows,
+            .fill = fill,
+            .chunks = std::vector<std::vector<T>>(chunksPerRow * chunkRows),
+        };
+    }
+
+    inline
+    size_t ChunkCount() const
+    {
+        return chunks.size();
+    }
+
+    inline
+    size_t ChunkOf(int x, int y) const
+    {
+        return (y >> gChunkShift) * chunksPerRow + (x >> gChunkShift);
+    }
+
+    inline
+    size_t OffsetInChunk(int x, int y) const
+    {
+        return Layout::Offset(x & (gChunkSize - 1), y & (gChunkSize - 1));
+    }
+
+    // Top left cell of a chunk
+    inline
+    V2<i32> ChunkOrigin(size_t chunk) const
+    {
+        return { (i32)((chunk % chunksPerRow) << gChunkShift),
+                 (i32)((chunk / chunksPerRow) << gChunkShift) };
+    }
+
+    inline
+    bool IsAllocated(size_t chunk) const
+    {
+        return !chunks[chunk].empty();
+    }
+
+    inline
+    void Allocate(size_t chunk)
+    {
+        if (chunks[chunk].empty())
+        {
+            chunks[chunk].assign(gChunkCells, fill);
+        }
+    }
+
+    // Whether the chunk may hold anything but fill
+    inline
+    bool HoldsData(size_t chunk) const
+    {
+        return pager ? pager->Holds(chunk) : IsAllocated(chunk);
+    }
+
+    // Moves every chunk into a file at path, keeping at most capacity of
+    // them in memory from then on
+    bool Page(const char* path, size_t capacity)
+    {
+        assert(!pager);
+
+        std::vector<T> fillChunk(gChunkCells, fill);
+        pager = ChunkPager::Create(path, ChunkCount(),
+                                   gChunkCells * sizeof(T),
+                                   fillChunk.data(), capacity);
+        if (!pager)
+        {
+            return false;
+        }
+
+        for (size_t chunk = 0; chunk < ChunkCount(); chunk++)
+        {
+            if (IsAllocated(chunk))
+            {
+                memcpy(pager->Fetch(chunk, true), chunks[chunk].data(),
+                       gChunkCells * sizeof(T));
+                chunks[chunk] = {};
+            }
+        }
+
+        return true;
+    }
+
+    // Whole chunk, nullptr when it is known to be all fill
+    inline
+    const T* ChunkData(size_t chunk) const
+    {
+        if (pager)
+        {
+            return (const T*)pager->Fetch(chunk, false);
+        }
+        return IsAllocated(chunk) ? chunks[chunk].data() : nullptr;
+    }
+
+    // Whole chunk to write, allocated if it isn't yet
+    inline
+    T* WritableChunk(size_t chunk)
+    {
+        if (pager)
+        {
+            return (T*)pager->Fetch(chunk, true);
+        }
+        Allocate(chunk);
+        return chunks[chunk].data();
+    }
+
+    // Never allocates
+    inline
+    T Get(int x, int y) const
+    {
+        assert(x >= 0 && x < (i32)dimensions.x);
+        assert(y >= 0 && y < (i32)dimensions.y);
+
+        if (pager)
+        {
+            return ChunkData(ChunkOf(x, y))[OffsetInChunk(x, y)];
+        }
+
+        const std::vector<T>& chunk = chunks[ChunkOf(x, y)];
+        return chunk.empty() ? fill : chunk[OffsetInChunk(x, y)];
+    }
+
+    // Starts loading the cell into the cache. Never pages a chunk in or
+    // allocates one, a cell in neither reads as fill anyway
+    inline
+    void Prefetch(int x, int y) const
+    {
+        if (pager)
+        {
+            return;
+        }
+
+        const std::vector<T>& chunk = chunks[ChunkOf(x, y)];
+        if (!chunk.empty())
+        {
+            __builtin_prefetch(chunk.data() + OffsetInChunk(x, y));
+        }
+    }
+
+    // Allocates the chunk if it isn't yet
+    inline
+    T& At(int x, int y)
+    {
+        assert(x >= 0 && x < (i32)dimensions.x);
+        assert(y >= 0 && y < (i32)dimensions.y);
+
+        return WritableChunk(ChunkOf(x, y))[OffsetInChunk(x, y)];
+    }
+
+    inline
+    void Set(int x, int y, T value)
+    {
+        At(x, y) = value;
+    }
+};
@@ -0,0 +1,165 @@
+#include "chunkpager.h"
+
+#include <cstdio>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+std::shared_ptr<ChunkPager> ChunkPager::Create(const char* path,
+                                               size_t chunkCount,
+                                               size_t chunkBytes,
+                                               const void* fillChunk,
+                                               size_t capacity)
+{
+    assert(capacity > 0 && capacity < gNoPageSlot);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0)
+    {
+        fprintf(stderr, "can't create page file %s\n", path);
+        return nullptr;
+    }
+    unlink(path);
+
+    capacity = std::min(capacity, chunkCount);
+
+    std::shared_ptr<ChunkPager> pager = std::make_shared<ChunkPager>();
+    pager->fd = fd;
+    pager->chunkBytes = chunkBytes;
+    pager->capacity = capacity;
+    pager->fillChunk.assign((const u8*)fillChunk,
+                           (const u8*)fillChunk + chunkBytes);
+
+    pager->slotOf.assign(chunkCount, gNoPageSlot);
+    pager->stored.assign(chunkCount, 0);
+
+    pager->buffers.resize(capacity * chunkBytes);
+    pager->chunkOf.assign(capacity, 0);
+    pager->dirty.assign(capacity, 0);
+    pager->newer.assign(capacity, gNoPageSlot);
+    pager->older.assign(capacity, gNoPageSlot);
+
+    return pager;
+}
+
+ChunkPager::~ChunkPager()
+{
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+void ChunkPager::Share(size_t first, size_t end)
+{
+    assert(!shared && first <= end && end - first <= capacity);
+
+    // The most recently used ones, none of them goes for another
+    for (size_t chunk = first; chunk < end; chunk++)
+    {
+        Fetch(chunk, false);
+    }
+
+    shared = true;
+}
+
+u32 ChunkPager::Load(size_t chunk)
+{
+    u32 slot = 0;
+
+    if (slotsUsed < capacity)
+    {
+        slot = slotsUsed++;
+    }
+    else
+    {
+        slot = leastRecent;
+        Unlink(slot);
+
+        size_t evicted = chunkOf[slot];
+        slotOf[evicted] = gNoPageSlot;
+
+        if (dirty[slot])
+        {
+            off_t offset = (off_t)evicted * chunkBytes;
+            if (pwrite(fd, buffers.data() + slot * chunkBytes,
+                       chunkBytes, offset) != (ssize_t)chunkBytes)
+            {
+                fprintf(stderr, "can't write chunk %zu to the page file\n",
+                        evicted);
+                abort();
+            }
+            stored[evicted] = 1;
+            writes++;
+        }
+    }
+
+    u8* buffer = buffers.data() + slot * chunkBytes;
+
+    if (stored[chunk])
+    {
+        off_t offset = (off_t)chunk * chunkBytes;
+        if (pread(fd, buffer, chunkBytes, offset) != (ssize_t)chunkBytes)
+        {
+            fprintf(stderr, "can't read chunk %zu from the page file\n",
+                    chunk);
+            abort();
+        }
+        loads++;
+    }
+    else
+    {
+        memcpy(buffer, fillChunk.data(), chunkBytes);
+    }
+
+    chunkOf[slot] = chunk;
+    dirty[slot] = 0;
+    slotOf[chunk] = slot;
+    LinkFront(slot);
+
+    return slot;
+}
+
+void ChunkPager::Unlink(u32 slot)
+{
+    u32 before = newer[slot];
+    u32 after = older[slot];
+
+    if (before != gNoPageSlot)
+    {
+        older[before] = after;
+    }
+    else
+    {
+        mostRecent = after;
+    }
+
+    if (after != gNoPageSlot)
+    {
+        newer[after] = before;
+    }
+    else
+    {
+        leastRecent = before;
+    }
+}
+
+void ChunkPager::LinkFront(u32 slot)
+{
+    newer[slot] = gNoPageSlot;
+    older[slot] = mostRecent;
+
+    if (mostRecent != gNoPageSlot)
+    {
+        newer[mostRecent] = slot;
+    }
+    else
+    {
+        leastRecent = slot;
+    }
+    mostRecent = slot;
+}
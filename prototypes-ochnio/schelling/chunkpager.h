@@ -0,0 +1,126 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cassert>
+
+#include "gametypes.h"
+
+
+constexpr u32 gNoPageSlot = 0xffffffff;
+
+// Fixed size chunks kept in a file, at most capacity of them in memory.
+// The least recently used one goes when another has to come in, written
+// back only if it changed. Chunks never written read as the fill chunk
+// and take no room in the file.
+//
+// The file is unlinked as soon as it is open: it goes away with the
+// process, and any number of pagers can be made with the same path.
+//
+// Not thread safe, and a fetched chunk stays valid only until the next
+// Fetch, except while a range of chunks is shared (see Share). A failed
+// read or write of the file aborts: every access goes through Fetch and
+// can't fail, and going on would simulate on a chunk that was lost or
+// never read.
+struct ChunkPager
+{
+    int fd = -1;
+    size_t chunkBytes = 0;
+    size_t capacity = 0;
+
+    std::vector<u8> fillChunk = {};
+
+    // Per chunk
+    std::vector<u32> slotOf = {};
+    std::vector<u8> stored = {};
+
+    // Per slot, the lists run from most to least recently used
+    std::vector<u8> buffers = {};
+    std::vector<u32> chunkOf = {};
+    std::vector<u8> dirty = {};
+    std::vector<u32> newer = {};
+    std::vector<u32> older = {};
+    u32 mostRecent = gNoPageSlot;
+    u32 leastRecent = gNoPageSlot;
+    u32 slotsUsed = 0;
+
+    u64 loads = 0;
+    u64 writes = 0;
+
+    // Set between Share and EndShare
+    bool shared = false;
+
+    static
+    std::shared_ptr<ChunkPager> Create(const char* path,
+                                       size_t chunkCount,
+                                       size_t chunkBytes,
+                                       const void* fillChunk,
+                                       size_t capacity);
+
+    ~ChunkPager();
+
+    // Marks the chunk changed when write is set
+    inline
+    u8* Fetch(size_t chunk, bool write)
+    {
+        if (shared)
+        {
+            return FetchShared(chunk, write);
+        }
+
+        u32 slot = slotOf[chunk];
+        if (slot == gNoPageSlot)
+        {
+            slot = Load(chunk);
+        }
+        else if (slot != mostRecent)
+        {
+            Unlink(slot);
+            LinkFront(slot);
+        }
+
+        dirty[slot] |= write ? 1 : 0;
+        return buffers.data() + slot * chunkBytes;
+    }
+
+    // Nothing moves in or out while shared, any thread can fetch the
+    // shared chunks and write to different parts of them
+    inline
+    u8* FetchShared(size_t chunk, bool write)
+    {
+        u32 slot = slotOf[chunk];
+        assert(slot != gNoPageSlot);
+
+        if (write)
+        {
+            std::atomic_ref<u8>(dirty[slot]).store(1,
+                                                std::memory_order_relaxed);
+        }
+        return buffers.data() + slot * chunkBytes;
+    }
+
+    // Loads the chunks in [first, end), at most capacity of them, and
+    // keeps them in memory until EndShare. Only those can be fetched in
+    // between
+    void Share(size_t first, size_t end);
+
+    inline
+    void EndShare()
+    {
+        shared = false;
+    }
+
+    // Whether the chunk was ever written, resident or not
+    inline
+    bool Holds(size_t chunk)
+    {
+        return slotOf[chunk] != gNoPageSlot || stored[chunk];
+    }
+
+    // Into the least recently used slot, writing that one back
+    u32 Load(size_t chunk);
+
+    void Unlink(u32 slot);
+    void LinkFront(u32 slot);
+};
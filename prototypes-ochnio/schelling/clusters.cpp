@@ -0,0 +1,310 @@
+#include "clusters.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+
+// Set on a root's label once it holds the cluster number instead of a
+// cell index
+constexpr u32 gNumberedRoot = gMaxClusterCells;
+
+// Until clusters are numbered a label is the index of a cell further up
+// the same tree. Unions hang the larger root under the smaller one, so a
+// root is the first cell of its tree and labels only ever point back
+static u32 FindRoot(u32* labels, u32 cell)
+{
+    while (labels[cell] != cell)
+    {
+        // Path halving
+        labels[cell] = labels[labels[cell]];
+        cell = labels[cell];
+    }
+    return cell;
+}
+
+static void Union(u32* labels, u32 a, u32 b)
+{
+    a = FindRoot(labels, a);
+    b = FindRoot(labels, b);
+
+    if (a < b)
+    {
+        labels[b] = a;
+    }
+    else if (b < a)
+    {
+        labels[a] = b;
+    }
+}
+
+ClusterStats ClusterStats::Compute(InhabitantSystem* system,
+                                   EConnectivity connectivity)
+{
+    V2<size_t> dimensions = system->dimensions;
+    size_t width = dimensions.x;
+    size_t height = dimensions.y;
+    size_t cellCount = width * height;
+
+    assert(cellCount < gMaxClusterCells);
+
+    ClusterStats stats = {
+        .connectivity = connectivity,
+        .dimensions = dimensions,
+        .labels = std::vector<u32>(cellCount, gNoCluster),
+        .largest = std::vector<u64>(system->settings.archetypes.size(), 0),
+    };
+
+    u32* labels = stats.labels.data();
+    bool eight = connectivity == EConnectivity::Eight;
+
+    // A byte per cell, neighbours are compared without going through the
+    // inhabitant columns
+    std::vector<ArchetypeIndex> kinds(cellCount);
+
+    auto join = [&](u32 cell, u32 other)
+    {
+        if (labels[other] != gNoCluster && kinds[other] == kinds[cell])
+        {
+            Union(labels, cell, other);
+        }
+    };
+
+    // Tiles only look at cells of their own, so they can't race
+    size_t tilesPerRow = (width + gClusterTileSize - 1) / gClusterTileSize;
+    size_t tileRows = (height + gClusterTileSize - 1) / gClusterTileSize;
+
+    system->ParallelFor(tilesPerRow * tileRows, [&](size_t tile, u32)
+    {
+        size_t x0 = (tile % tilesPerRow) * gClusterTileSize;
+        size_t y0 = (tile / tilesPerRow) * gClusterTileSize;
+        size_t x1 = std::min(width, x0 + gClusterTileSize);
+        size_t y1 = std::min(height, y0 + gClusterTileSize);
+
+        for (size_t y = y0; y < y1; y++)
+        for (size_t x = x0; x < x1; x++)
+        {
+            u32 cell = y * width + x;
+
+            InhabitantID id = system->CellAt(x, y).Id();
+            if (id < 0)
+            {
+                continue;
+            }
+
+            kinds[cell] = system->inhabitants.archetype[id];
+            labels[cell] = cell;
+
+            // Neighbours already visited in raster order
+            if (x > x0)
+            {
+                join(cell, cell - 1);
+            }
+            if (y > y0)
+            {
+                join(cell, cell - width);
+
+                if (eight && x > x0)
+                {
+                    join(cell, cell - width - 1);
+                }
+                if (eight && x + 1 < x1)
+                {
+                    join(cell, cell - width + 1);
+                }
+            }
+        }
+    });
+
+    // Tile borders, few enough cells to merge on one thread
+    for (size_t x = gClusterTileSize; x < width; x += gClusterTileSize)
+    for (size_t y = 0; y < height; y++)
+    {
+        u32 cell = y * width + x;
+        if (labels[cell] == gNoCluster)
+        {
+            continue;
+        }
+
+        join(cell, cell - 1);
+        if (eight && y > 0)
+        {
+            join(cell, cell - width - 1);
+        }
+        if (eight && y + 1 < height)
+        {
+            join(cell, cell + width - 1);
+        }
+    }
+
+    for (size_t y = gClusterTileSize; y < height; y += gClusterTileSize)
+    for (size_t x = 0; x < width; x++)
+    {
+        u32 cell = y * width + x;
+        if (labels[cell] == gNoCluster)
+        {
+            continue;
+        }
+
+        join(cell, cell - width);
+        if (eight && x > 0)
+        {
+            join(cell, cell - width - 1);
+        }
+        if (eight && x + 1 < width)
+        {
+            join(cell, cell - width + 1);
+        }
+    }
+
+    // Every label straight to its root. Rows flatten side by side, a
+    // label read half way is still on the path to the same root
+    std::vector<u32> rowRoots(height, 0);
+
+    system->ParallelFor(height, [&](size_t y, u32)
+    {
+        for (size_t x = 0; x < width; x++)
+        {
+            u32 cell = y * width + x;
+            if (labels[cell] == gNoCluster)
+            {
+                continue;
+            }
+
+            u32 root = cell;
+            while (true)
+            {
+                u32 parent = std::atomic_ref<u32>(labels[root])
+                                .load(std::memory_order_relaxed);
+                if (parent == root)
+                {
+                    break;
+                }
+                root = parent;
+            }
+
+            std::atomic_ref<u32>(labels[cell])
+                .store(root, std::memory_order_relaxed);
+            rowRoots[y] += root == cell ? 1 : 0;
+        }
+    });
+
+    std::vector<u32> rowFirstCluster(height, 0);
+    u32 clusterCount = 0;
+    for (size_t y = 0; y < height; y++)
+    {
+        rowFirstCluster[y] = clusterCount;
+        clusterCount += rowRoots[y];
+    }
+
+    stats.sizes.resize(clusterCount, 0);
+    stats.archetypes.resize(clusterCount, 0);
+
+    // Roots take their number first, the rest of the cells copy it from
+    // their root after
+    system->ParallelFor(height, [&](size_t y, u32)
+    {
+        u32 cluster = rowFirstCluster[y];
+        for (size_t x = 0; x < width; x++)
+        {
+            u32 cell = y * width + x;
+            if (labels[cell] == cell)
+            {
+                stats.archetypes[cluster] = kinds[cell];
+                labels[cell] = cluster++ | gNumberedRoot;
+            }
+        }
+    });
+
+    system->ParallelFor(height, [&](size_t y, u32)
+    {
+        for (size_t x = 0; x < width; x++)
+        {
+            u32 cell = y * width + x;
+            u32 label = labels[cell];
+            if (label == gNoCluster || (label & gNumberedRoot))
+            {
+                continue;
+            }
+
+            labels[cell] = labels[label] & ~gNumberedRoot;
+        }
+    });
+
+    // Clusters span rows, so sizes are added atomically, once per run of
+    // a cluster's cells in a row
+    system->ParallelFor(height, [&](size_t y, u32)
+    {
+        u32 run = gNoCluster;
+        u32 runLength = 0;
+
+        for (size_t x = 0; x <= width; x++)
+        {
+            u32 label = gNoCluster;
+            if (x < width && labels[y * width + x] != gNoCluster)
+            {
+                u32 cell = y * width + x;
+                label = labels[cell] & ~gNumberedRoot;
+                labels[cell] = label;
+            }
+
+            if (label == run)
+            {
+                runLength++;
+                continue;
+            }
+
+            if (run != gNoCluster)
+            {
+                std::atomic_ref<u32>(stats.sizes[run])
+                    .fetch_add(runLength, std::memory_order_relaxed);
+            }
+            run = label;
+            runLength = 1;
+        }
+    });
+
+    for (u32 cluster = 0; cluster < clusterCount; cluster++)
+    {
+        u64& largest = stats.largest[stats.archetypes[cluster]];
+        largest = std::max<u64>(largest, stats.sizes[cluster]);
+    }
+
+    // Most clusters are small, those are counted directly and only the
+    // few big ones sorted
+    constexpr u32 smallSizes = 4096;
+    std::vector<u64> smallCounts(smallSizes, 0);
+    std::vector<u32> bigSizes = {};
+
+    for (u32 size : stats.sizes)
+    {
+        if (size < smallSizes)
+        {
+            smallCounts[size]++;
+        }
+        else
+        {
+            bigSizes.push_back(size);
+        }
+    }
+
+    for (u32 size = 1; size < smallSizes; size++)
+    {
+        if (smallCounts[size] > 0)
+        {
+            stats.histogram.push_back({ .size = size,
+                                        .count = smallCounts[size] });
+        }
+    }
+
+    std::sort(bigSizes.begin(), bigSizes.end());
+    for (u32 size : bigSizes)
+    {
+        if (stats.histogram.empty() || stats.histogram.back().size != size)
+        {
+            stats.histogram.push_back({ .size = size });
+        }
+        stats.histogram.back().count++;
+    }
+
+    return stats;
+}
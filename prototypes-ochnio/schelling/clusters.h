@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+
+#include "gametypes.h"
+#include "inhabitant.h"
+
+
+// Tiles labelled independently before their borders are merged
+constexpr size_t gClusterTileSize = 256;
+
+constexpr u32 gNoCluster = 0xffffffff;
+
+// Labels are cell indices with the top bit kept for numbering, so only
+// grids of fewer cells than this can be labelled
+constexpr size_t gMaxClusterCells = 0x80000000;
+
+enum class EConnectivity
+{
+    // Edge neighbours only, the simulation's own neighbourhood
+    Four = 0,
+
+    // Diagonals too
+    Eight,
+};
+
+struct ClusterSizeCount
+{
+    u64 size = 0;
+    u64 count = 0;
+};
+
+// Regions of connected same archetype inhabitants, found by a union find
+// labelling: every tile is labelled on its own in parallel, then the
+// labels are merged across tile borders and numbered. The result doesn't
+// depend on the thread count.
+struct ClusterStats
+{
+    EConnectivity connectivity = EConnectivity::Four;
+    V2<size_t> dimensions = {};
+
+    // Cluster of every cell, gNoCluster for empty ones. Clusters are
+    // numbered in row major order of their first cell
+    std::vector<u32> labels = {};
+
+    // Per cluster
+    std::vector<u32> sizes = {};
+    std::vector<ArchetypeIndex> archetypes = {};
+
+    // How many clusters there are of every size found, ascending
+    std::vector<ClusterSizeCount> histogram = {};
+
+    // Per archetype size of its largest cluster, 0 without inhabitants
+    std::vector<u64> largest = {};
+
+    static
+    ClusterStats Compute(InhabitantSystem* system,
+                         EConnectivity connectivity);
+
+    inline
+    u32 LabelAt(int x, int y)
+    {
+        return labels[(y * dimensions.x) + x];
+    }
+};
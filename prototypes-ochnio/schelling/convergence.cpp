@@ -0,0 +1,72 @@
+#include "convergence.h"
+
+#include <algorithm>
+
+const char* StopReasonName(EStopReason reason)
+{
+    switch (reason)
+    {
+        case EStopReason::Running:  return "running";
+        case EStopReason::Static:   return "static";
+        case EStopReason::Settled:  return "settled";
+        case EStopReason::Cycle:    return "cycle";
+        case EStopReason::MaxTurns: return "max turns";
+    }
+    return "unknown";
+}
+
+ConvergenceTracker
+ConvergenceTracker::Create(ConvergenceSettings settings)
+{
+    return {
+        .settings = settings,
+        .recentStates = std::vector<u64>(settings.cycleWindow, 0),
+    };
+}
+
+EStopReason
+ConvergenceTracker::Record(u64 moves, f32 unhappyFraction, u64 stateHash)
+{
+    movesPerTurn.push_back(moves);
+
+    if (MeasuresUnhappy())
+    {
+        unhappyFractions.push_back(unhappyFraction);
+    }
+
+    if (moves == 0)
+    {
+        reason = EStopReason::Static;
+        return reason;
+    }
+
+    if (settings.settledFraction >= 0.0f
+        && unhappyFraction <= settings.settledFraction)
+    {
+        reason = EStopReason::Settled;
+        return reason;
+    }
+
+    size_t window = recentStates.size();
+    if (window > 0)
+    {
+        size_t filled = std::min(statesRecorded, window);
+        for (size_t back = 1; back <= filled; back++)
+        {
+            size_t slot = (nextState + window - back) % window;
+            if (recentStates[slot] == stateHash)
+            {
+                cyclePeriod = back;
+                reason = EStopReason::Cycle;
+                return reason;
+            }
+        }
+
+        recentStates[nextState] = stateHash;
+        nextState = (nextState + 1) % window;
+        statesRecorded++;
+    }
+
+    reason = EStopReason::Running;
+    return reason;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <vector>
+
+#include "gametypes.h"
+
+
+enum class EStopReason
+{
+    // Still changing
+    Running = 0,
+
+    // A turn went by without a single move, nothing will move again
+    Static,
+
+    // No more than settledFraction of the inhabitants are unhappy
+    Settled,
+
+    // The grid came back to a state seen within cycleWindow turns.
+    // Tie-breaks differ per turn so it may still leave the cycle, but it
+    // is going in circles rather than towards equilibrium
+    Cycle,
+
+    // RunUntilConverged ran out of turns first
+    MaxTurns,
+};
+
+const char* StopReasonName(EStopReason reason);
+
+// Longest cycle window, the detector keeps a hash per turn of it
+constexpr u32 gMaxCycleWindow = 1 << 20;
+
+struct ConvergenceResult
+{
+    // Turns run by the call that returned this
+    u64 turns = 0;
+    EStopReason reason = EStopReason::Running;
+};
+
+struct ConvergenceSettings
+{
+    // Stop once no more than this fraction of inhabitants is unhappy.
+    // Negative never stops on it
+    f32 settledFraction = -1.0f;
+
+    // Record the unhappy fraction every turn even when not stopping on it,
+    // costs a pass over the whole grid per turn
+    bool trackUnhappy = false;
+
+    // Turn end states remembered by the cycle detector, 0 turns it off
+    u32 cycleWindow = 0;
+};
+
+// Per turn history of a run and the verdict on whether it's done.
+// Fed once per finished turn by InhabitantSystem.
+struct ConvergenceTracker
+{
+    ConvergenceSettings settings = {};
+
+    std::vector<u64> movesPerTurn = {};
+
+    // Only filled when the unhappy fraction is measured
+    std::vector<f32> unhappyFractions = {};
+
+    // Last cycleWindow turn end state hashes, a ring
+    std::vector<u64> recentStates = {};
+    size_t nextState = 0;
+    size_t statesRecorded = 0;
+
+    // Turns between the two matching states of a detected cycle
+    u64 cyclePeriod = 0;
+
+    EStopReason reason = EStopReason::Running;
+
+    static
+    ConvergenceTracker Create(ConvergenceSettings settings);
+
+    inline
+    bool MeasuresUnhappy()
+    {
+        return settings.trackUnhappy || settings.settledFraction >= 0.0f;
+    }
+
+    // Records a finished turn and updates reason. unhappyFraction is
+    // ignored unless MeasuresUnhappy()
+    EStopReason Record(u64 moves, f32 unhappyFraction, u64 stateHash);
+};
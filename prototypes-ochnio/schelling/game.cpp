@@ -12,6 +12,7 @@
 
 #include "gamesettings.h"
 #include "inhabitant.h"
+#include "inhabitantrendering.h"
 
 #define RLIGHTS_IMPLEMENTATION
 #include "rlights.h"
@@ -20,30 +21,78 @@
 
 void Game::Update(f32 dt)
 {
-    if (IsKeyDown(KEY_SPACE))
+    InhabitantSystem& inhabitants = simulation.inhabitants;
+
+    if (replaying)
+    {
+        u64 turn = inhabitants.turnCount;
+
+        if (IsKeyPressed(KEY_RIGHT))
+        {
+            replay.Seek(turn + replaySeekTurns, &inhabitants);
+        }
+        else if (IsKeyPressed(KEY_LEFT))
+        {
+            replay.Seek(turn > replaySeekTurns ? turn - replaySeekTurns : 0,
+                        &inhabitants);
+        }
+        else if (IsKeyDown(KEY_SPACE))
+        {
+            replay.StartNextTurn(&inhabitants);
+        }
+    }
+    else if (IsKeyDown(KEY_SPACE))
     {
-        sInhabitants.StartNextTurn();
+        inhabitants.StartNextTurn();
     }
 
-    sInhabitants.UpdateCellMovement(dt);
+    inhabitants.UpdateCellMovement(dt);
 }
 
+bool Game::StartReplay(const char* path)
+{
+    MoveReplay opened = {};
+    if (!MoveReplay::Open(path, &opened))
+    {
+        return false;
+    }
 
+    // The recorded run's terrain and inhabitants
+    SimulationSettings settings = simulation.settings;
+    settings.seed = opened.log.header.seed;
+    settings.world.size = opened.log.header.width;
+    settings.inhabitants.size = opened.log.header.width;
 
-Game Game::Create()
-{
+    SimulationContext context = SimulationContext::Create(settings);
+    if (!opened.Seek(opened.FirstTurn(), &context.inhabitants))
+    {
+        opened.Close();
+        return false;
+    }
 
-    GameSettings::Init();
+    if (replaying)
+    {
+        replay.Close();
+    }
+
+    simulation = std::move(context);
+    replay = opened;
+    replaying = true;
+    return true;
+}
+
+
+
+Game Game::Create(u64 seed)
+{
     Game game {};
 
     game.resources.Init();
 
-    game.world = World::Create();
-
-    game.sInhabitants = InhabitantSystem::Create();
+    SimulationSettings settings = GameSettings::Defaults();
+    settings.seed = seed;
 
-    game.world.Randomize();
-    game.sInhabitants.Populate();
+    game.simulation = SimulationContext::Create(settings);
 
 
     Shader s = game.resources.shaders["LightingShader"];
@@ -65,14 +114,16 @@ void Game::Draw(f32 dt, V2<i32> centerPosition)
 
     AABB<i32> cullingBox = GetDrawSlice(centerPosition);
 
-    worldDrawing.DrawWorld(&world, cullingBox);
-    sInhabitants.Draw(cullingBox, &resources);
+    worldDrawing.DrawWorld(simulation.world.get(), cullingBox);
+    inhabitantDrawing.DrawInhabitants(&simulation.inhabitants,
+                                      cullingBox,
+                                      &resources);
 
 }
 
 AABB<i32> Game::GetDrawSlice(V2<i32> centerPosition)
 {
-    WorldSettings& ws = GameSettings::worldSettings;
+    WorldSettings& ws = simulation.settings.world;
 
     int xMin = centerPosition.x - (drawSize / 2);
     int yMin = centerPosition.y - (drawSize / 2);
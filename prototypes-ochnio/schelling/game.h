@@ -6,18 +6,27 @@
 #include "worldrendering.h"
 
 #include "inhabitant.h"
+#include "inhabitantrendering.h"
 
+#include "simulation.h"
 #include "gamesettings.h"
+#include "replay.h"
 
 #include "rlights.h"
 
 
 struct Game
 {
-    World world {};
-    WorldDrawSystem worldDrawing {};
+    SimulationContext simulation {};
+
+    // Turns come from a move log instead of the simulation when set.
+    // Arrow keys jump replaySeekTurns back and forth
+    bool replaying = false;
+    MoveReplay replay {};
+    u64 replaySeekTurns = 100;
 
-    InhabitantSystem sInhabitants {};
+    WorldDrawSystem worldDrawing {};
+    InhabitantDrawSystem inhabitantDrawing {};
 
 
     Resources resources {};
@@ -36,7 +45,10 @@ struct Game
 
 
     // Functions 
-    static Game Create();
+    static Game Create(u64 seed);
+
+    // Replaces the simulation with the recorded one at its first turn
+    bool StartReplay(const char* path);
 
     void Draw(f32 dt, V2<i32> centerPosition);
     void Update (f32 dt);
@@ -1,5 +1,6 @@
 #include "gamecontroller.h"
 #include "math.h"
+#include "utils.h"
 #include <cmath>
 
 void GameController::Update(float deltaTime, Game* game)
@@ -1,27 +1,25 @@
 #include "gamesettings.h"
 
-WorldSettings GameSettings::worldSettings = {};
-InhabitantsSettings GameSettings::inhabitantSettings = {};
-
-void GameSettings::Init()
+SimulationSettings GameSettings::Defaults()
 {
-    GameSettings::worldSettings =
-    { 
-        .size = 64
-    };
+    return {
+        .world =
+        { 
+            .size = 64
+        },
 
-    GameSettings::inhabitantSettings = 
-    {
-        .gMaxInhabitants = 0.5f,
-        .gIntoleranceFactor = 0.1f,
-        .archetypes = 
+        .inhabitants =
         {
-            { RED },
-            { BLUE },
-            { GREEN },
-            { YELLOW },
-            { PURPLE },
-        }
+            .gMaxInhabitants = 0.5f,
+            .gIntoleranceFactor = 0.1f,
+            .archetypes = 
+            {
+                { { 230, 41, 55, 255 } },   // RED
+                { { 0, 121, 241, 255 } },   // BLUE
+                { { 0, 228, 48, 255 } },    // GREEN
+                { { 253, 249, 0, 255 } },   // YELLOW
+                { { 200, 122, 255, 255 } }, // PURPLE
+            }
+        },
     };
-
 }
@@ -1,12 +1,9 @@
 #pragma once
 
-#include "inhabitant.h"
-#include "world.h"
+#include "simulation.h"
 
+// What the game and the tools start a simulation with
 struct GameSettings
 {
-    static WorldSettings worldSettings;
-    static InhabitantsSettings inhabitantSettings;
-
-    static void Init();
+    static SimulationSettings Defaults();
 };
@@ -1,12 +1,17 @@
 #pragma once
 #include <limits>
 #include <cstdint>
+#include <cstddef>
 
 // Floats
 using f32 = float;
 static_assert((sizeof(f32) == 4) 
               && "platform does not have 32b float!");
 
+using f64 = double;
+static_assert((sizeof(f64) == 8) 
+              && "platform does not have 64b float!");
+
 using f16 = short;
 static_assert((sizeof(f16) == 2) 
               && "platform does not have 16b float!");
@@ -14,6 +19,7 @@ static_assert((sizeof(f16) == 2)
 
 
 constexpr float f32Min = std::numeric_limits<f32>::min();
+constexpr float f32Lowest = std::numeric_limits<f32>::lowest();
 // Floats End
 
 
@@ -22,6 +28,8 @@ constexpr float f32Min = std::numeric_limits<f32>::min();
 constexpr int32_t i32Min = std::numeric_limits<int32_t>::min();
 constexpr int32_t i32Max = std::numeric_limits<int32_t>::max();
 
+using u8 = uint8_t;
+using i8 = int8_t;
 using u16 = uint16_t;
 using i16 = int16_t;
 using u32 = uint32_t;
@@ -29,3 +37,20 @@ using i32 = int32_t;
 using u64 = uint64_t;
 using i64 = int64_t;
 // Ints End
+
+
+// Colors
+
+// Plain 8 bit per channel color, same layout as raylib's Color so the
+// simulation core can carry archetype colors without raylib.h
+struct RGBA8
+{
+    u8 r, g, b, a;
+};
+
+inline bool RGBA8Equal(RGBA8 a, RGBA8 b)
+{
+    return a.r == b.r && a.g == b.g
+        && a.b == b.b && a.a == b.a;
+}
+// Colors End
@@ -0,0 +1,192 @@
+#include "gillespie.h"
+
+#include <cmath>
+#include <cassert>
+#include <algorithm>
+
+// Global and best vacancy movement only look at the inhabitant's own
+// neighbours, adjacent movement also at those of the cells it could go to
+static i32 RateRadius(InhabitantSystem* system)
+{
+    return system->settings.movementMode == EMovementMode::Adjacent
+            ? gInfluenceRadius
+            : 1;
+}
+
+GillespieEngine GillespieEngine::Create(InhabitantSystem* system,
+                                        f64 relocationRate)
+{
+    assert(!system->turnInProgress);
+    assert(relocationRate > 0.0);
+
+    size_t count = system->inhabitants.Count();
+
+    GillespieEngine engine = {
+        .relocationRate = relocationRate,
+        .rates = RateTree::Create(count),
+        .key = EventKey(system->seed),
+    };
+
+    // Rates only read the cells, every slice writes rates of its own
+    constexpr size_t sliceIds = 4096;
+    size_t slices = (count + sliceIds - 1) / sliceIds;
+    f64* leaves = engine.rates.levels[0].data();
+
+    system->ParallelFor(slices, [&](size_t slice, u32)
+    {
+        size_t end = std::min(count, (slice + 1) * sliceIds);
+        for (size_t id = slice * sliceIds; id < end; id++)
+        {
+            leaves[id] = engine.RateAt(system,
+                                       system->inhabitants.PositionOf(id));
+        }
+    });
+
+    engine.rates.Rebuild();
+    return engine;
+}
+
+f64 GillespieEngine::RateAt(InhabitantSystem* system, V2<i32> position)
+{
+    if (system->settings.movementMode == EMovementMode::Adjacent)
+    {
+        return system->HasBetterNeighbour(position) ? relocationRate : 0.0;
+    }
+
+    InhabitantID id = system->CellAt(position.x, position.y).Id();
+    return system->IsHappy(id, position) ? 0.0 : relocationRate;
+}
+
+bool GillespieEngine::Run(InhabitantSystem* system,
+                          f64 endTime,
+                          u64 maxEvents)
+{
+    assert(!system->turnInProgress);
+
+    for (u64 ran = 0; ran < maxEvents; ran++)
+    {
+        f64 total = rates.Total();
+        if (total <= 0.0)
+        {
+            return false;
+        }
+
+        RandomStream random = RandomStream::Create(key, events, 0);
+
+        // Exponential waiting time, 1 - unit is in (0, 1]
+        f64 wait = -std::log(1.0 - random.NextUnit()) / total;
+        if (time + wait > endTime)
+        {
+            return true;
+        }
+
+        InhabitantID id = (InhabitantID)rates.Find(random.NextUnit() * total);
+
+        time += wait;
+        events++;
+        Relocate(system, id, &random);
+    }
+
+    return true;
+}
+
+void GillespieEngine::Relocate(InhabitantSystem* system,
+                               InhabitantID id,
+                               RandomStream* random)
+{
+    InhabitantsSettings& iSettings = system->settings;
+
+    V2<i32> origin = system->inhabitants.PositionOf(id);
+    V2<i32> destination = origin;
+
+    if (iSettings.movementMode == EMovementMode::Adjacent)
+    {
+        i32 directions[gNeighbourCount] = {};
+        i32 count = system->BetterNeighbours(origin, directions);
+        assert(count > 0);
+
+        V2<i32> step = gNeighbourOffsets[directions[random->Next() % count]];
+        destination = { origin.x + step.x, origin.y + step.y };
+    }
+    else if (iSettings.movementMode == EMovementMode::Global)
+    {
+        if (system->vacancies.Count() == 0)
+        {
+            return;
+        }
+
+        u32 vacancy = system->vacancies.Sample(random->Next());
+        destination = system->CellPosition(vacancy);
+    }
+    else
+    {
+        ArchetypeIndex type = system->inhabitants.archetype[id];
+        u32 vacancy = system->FindBestVacancy(type, origin, random);
+        if (vacancy == InvalidSlot)
+        {
+            return;
+        }
+
+        destination = system->CellPosition(vacancy);
+        if (system->CalcCellScore(type, destination, origin)
+                <= system->CalcCellScore(type, origin, origin))
+        {
+            return;
+        }
+    }
+
+    system->ApplyMove({ .id = id,
+                        .destination = destination,
+                        .origin = origin });
+    moves++;
+
+    // After an adjacent step the two areas mostly overlap, cells in both
+    // are looked at once
+    i32 radius = RateRadius(system);
+    UpdateRatesAround(system, destination, radius, {}, false);
+    UpdateRatesAround(system, origin, radius, destination, true);
+}
+
+void GillespieEngine::UpdateRatesAround(InhabitantSystem* system,
+                                        V2<i32> position,
+                                        i32 radius,
+                                        V2<i32> skip,
+                                        bool skipSet)
+{
+    i32 width = (i32)system->dimensions.x;
+    i32 height = (i32)system->dimensions.y;
+
+    for (i32 dy = -radius; dy <= radius; dy++)
+    {
+        i32 y = position.y + dy;
+        if (y < 0 || y >= height)
+        {
+            continue;
+        }
+
+        i32 reach = radius - std::abs(dy);
+        i32 xBegin = std::max(position.x - reach, 0);
+        i32 xEnd = std::min(position.x + reach + 1, width);
+
+        for (i32 x = xBegin; x < xEnd; x++)
+        {
+            if (skipSet
+                && std::abs(x - skip.x) + std::abs(y - skip.y) <= radius)
+            {
+                continue;
+            }
+
+            InhabitantID id = system->CellAt(x, y).Id();
+            if (id == InvalidId)
+            {
+                continue;
+            }
+
+            f64 rate = RateAt(system, { x, y });
+            if (rate != rates.RateOf(id))
+            {
+                rates.Set(id, rate);
+            }
+        }
+    }
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "gametypes.h"
+#include "math.h"
+#include "inhabitant.h"
+#include "ratetree.h"
+
+
+// Continuous time version of the model, for comparing with analytic
+// results. There are no turns: every inhabitant the turn based update
+// would move relocates at relocationRate, a Poisson clock of its own, and
+// the rest stay put. Which inhabitant that is follows the movement mode:
+//  - Adjacent: one with a strictly better empty cell next to it, which it
+//    steps to like UpdateCell does,
+//  - Global and best vacancy: an unhappy one, which jumps to a random
+//    vacancy or the best one if that beats staying.
+//
+// Events are drawn Gillespie style from a RateTree over the inhabitants:
+// the waiting time is exponential in the total rate, the inhabitant
+// proportional to its rate. A move only changes the rates within a few
+// cells of its two ends, those are the only ones looked at again.
+//
+// Runs on an InhabitantSystem between turns. Nothing else may change the
+// system while an engine runs on it, make a new engine after.
+struct GillespieEngine
+{
+    f64 relocationRate = 1.0;
+
+    RateTree rates = {};
+
+    // Of the last event
+    f64 time = 0.0;
+
+    u64 events = 0;
+
+    // Events that moved someone, a best vacancy can turn out no better
+    u64 moves = 0;
+
+    // EventKey of the system's seed
+    u64 key = 0;
+
+    static
+    GillespieEngine Create(InhabitantSystem* system, f64 relocationRate);
+
+    // Rate of the inhabitant standing at position as things are now
+    f64 RateAt(InhabitantSystem* system, V2<i32> position);
+
+    // Runs events until the next one would come after endTime or
+    // maxEvents have run. The event left over is drawn again by the next
+    // call, so a run split in several gives the same trajectory. False
+    // once no inhabitant has a rate left
+    bool Run(InhabitantSystem* system, f64 endTime, u64 maxEvents);
+
+    // Takes the inhabitant with the given id through its relocation
+    void Relocate(InhabitantSystem* system,
+                  InhabitantID id,
+                  RandomStream* random);
+
+    // Rates of the inhabitants at most radius steps from position looked
+    // at again, skipping those at most radius steps from skip when
+    // skipSet (already done)
+    void UpdateRatesAround(InhabitantSystem* system,
+                           V2<i32> position,
+                           i32 radius,
+                           V2<i32> skip,
+                           bool skipSet);
+};
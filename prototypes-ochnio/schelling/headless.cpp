@@ -0,0 +1,717 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <chrono>
+#include <cassert>
+
+#include "gametypes.h"
+#include "gamesettings.h"
+#include "simulation.h"
+#include "checkpoint.h"
+#include "movelog.h"
+#include "replay.h"
+#include "clusters.h"
+#include "gillespie.h"
+
+// Runs the schelling simulation without a window, as fast as the cpu
+// allows. Meant for parameter studies on machines with no display.
+
+struct HeadlessOptions
+{
+    u64 turns = 1000;
+    u64 seed = 0;
+    bool seeded = false;
+    bool dump = false;
+    bool metrics = false;
+    int clusters = 0;
+    const char* histogram = nullptr;
+    bool fullSweep = false;
+    bool converge = false;
+    bool trackUnhappy = false;
+    f32 settled = -1.0f;
+    int cycleWindow = -1;
+
+    int size = -1;
+    int archetypes = -1;
+    f32 density = f32Lowest;
+    f32 intolerance = -1.0f;
+
+    int threads = -1;
+    int tileSize = -1;
+    const char* mode = nullptr;
+    const char* backend = nullptr;
+    const char* movement = nullptr;
+    const char* save = nullptr;
+    const char* record = nullptr;
+    const char* replay = nullptr;
+    u64 seek = 0;
+    const char* load = nullptr;
+    const char* pageFile = nullptr;
+    u64 pagedChunks = 0;
+    f32 threshold = f32Lowest;
+
+    // Continuous time instead of turns when set
+    f64 continuous = -1.0;
+    u64 events = ~0ull;
+    f64 rate = 1.0;
+};
+
+static void PrintUsage(const char* program)
+{
+    printf("usage: %s [options]\n"
+           "  --turns N         turns to simulate (default 1000)\n"
+           "  --converge        stop early once converged, --turns is the limit\n"
+           "  --continuous T    run continuous time up to T instead of turns\n"
+           "  --events N        continuous time events at most\n"
+           "  --rate R          continuous time relocation rate (default 1)\n"
+           "  --settled F       converged once at most F are unhappy\n"
+           "  --cycle-window N  converged once a state repeats within N turns\n"
+           "  --unhappy         report the unhappy fraction\n"
+           "  --size N          world is N x N cells\n"
+           "  --density F       fraction of cells inhabited\n"
+           "  --intolerance F   neighbour score factor\n"
+           "  --archetypes K    number of inhabitant archetypes\n"
+           "  --seed S          random seed (default time)\n"
+           "  --movement M      adjacent | global | best\n"
+           "  --threshold F     happiness threshold of global and best movement\n"
+           "  --mode M          sweep | checkerboard | sync | async\n"
+           "  --threads N       worker threads for parallel modes\n"
+           "  --tile N          checkerboard tile side\n"
+           "  --backend B       counts | bitplanes\n"
+           "  --full-sweep      evaluate every cell, not just active ones\n"
+           "  --page-file FILE  keep the world in FILE, paged in as needed\n"
+           "  --page-chunks N   64 x 64 chunks of each grid kept in memory\n"
+           "  --load FILE       start from a checkpoint instead of populating\n"
+           "  --save FILE       write a checkpoint after the last turn\n"
+           "  --record FILE     write every turn's moves to a move log\n"
+           "  --replay FILE     play turns back from a move log\n"
+           "  --seek N          turn to start the replay at\n"
+           "  --metrics         track and print segregation measures\n"
+           "  --clusters 4|8    label the final clusters with that connectivity\n"
+           "  --histogram FILE  write the cluster size histogram, with --clusters\n"
+           "  --dump            print the final grid\n",
+           program);
+}
+
+static bool ParseOptions(int argc, const char** argv, HeadlessOptions* opts)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (strcmp(arg, "--dump") == 0)
+        {
+            opts->dump = true;
+        }
+        else if (strcmp(arg, "--metrics") == 0)
+        {
+            opts->metrics = true;
+        }
+        else if (strcmp(arg, "--clusters") == 0 && hasValue)
+        {
+            opts->clusters = atoi(argv[++i]);
+            if (opts->clusters != 4 && opts->clusters != 8)
+            {
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--histogram") == 0 && hasValue)
+        {
+            opts->histogram = argv[++i];
+        }
+        else if (strcmp(arg, "--full-sweep") == 0)
+        {
+            opts->fullSweep = true;
+        }
+        else if (strcmp(arg, "--converge") == 0)
+        {
+            opts->converge = true;
+        }
+        else if (strcmp(arg, "--unhappy") == 0)
+        {
+            opts->trackUnhappy = true;
+        }
+        else if (strcmp(arg, "--settled") == 0 && hasValue)
+        {
+            opts->settled = atof(argv[++i]);
+        }
+        else if (strcmp(arg, "--cycle-window") == 0 && hasValue)
+        {
+            opts->cycleWindow = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--turns") == 0 && hasValue)
+        {
+            opts->turns = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(arg, "--continuous") == 0 && hasValue)
+        {
+            opts->continuous = atof(argv[++i]);
+        }
+        else if (strcmp(arg, "--events") == 0 && hasValue)
+        {
+            opts->events = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(arg, "--rate") == 0 && hasValue)
+        {
+            opts->rate = atof(argv[++i]);
+            if (!(opts->rate > 0.0))
+            {
+                return false;
+            }
+        }
+        else if (strcmp(arg, "--size") == 0 && hasValue)
+        {
+            opts->size = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--density") == 0 && hasValue)
+        {
+            opts->density = atof(argv[++i]);
+        }
+        else if (strcmp(arg, "--intolerance") == 0 && hasValue)
+        {
+            opts->intolerance = atof(argv[++i]);
+        }
+        else if (strcmp(arg, "--archetypes") == 0 && hasValue)
+        {
+            opts->archetypes = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--mode") == 0 && hasValue)
+        {
+            opts->mode = argv[++i];
+        }
+        else if (strcmp(arg, "--movement") == 0 && hasValue)
+        {
+            opts->movement = argv[++i];
+        }
+        else if (strcmp(arg, "--threshold") == 0 && hasValue)
+        {
+            opts->threshold = atof(argv[++i]);
+        }
+        else if (strcmp(arg, "--save") == 0 && hasValue)
+        {
+            opts->save = argv[++i];
+        }
+        else if (strcmp(arg, "--record") == 0 && hasValue)
+        {
+            opts->record = argv[++i];
+        }
+        else if (strcmp(arg, "--replay") == 0 && hasValue)
+        {
+            opts->replay = argv[++i];
+        }
+        else if (strcmp(arg, "--seek") == 0 && hasValue)
+        {
+            opts->seek = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(arg, "--load") == 0 && hasValue)
+        {
+            opts->load = argv[++i];
+        }
+        else if (strcmp(arg, "--page-file") == 0 && hasValue)
+        {
+            opts->pageFile = argv[++i];
+        }
+        else if (strcmp(arg, "--page-chunks") == 0 && hasValue)
+        {
+            opts->pagedChunks = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(arg, "--backend") == 0 && hasValue)
+        {
+            opts->backend = argv[++i];
+        }
+        else if (strcmp(arg, "--threads") == 0 && hasValue)
+        {
+            opts->threads = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--tile") == 0 && hasValue)
+        {
+            opts->tileSize = atoi(argv[++i]);
+        }
+        else if (strcmp(arg, "--seed") == 0 && hasValue)
+        {
+            opts->seed = strtoull(argv[++i], nullptr, 10);
+            opts->seeded = true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool ApplyOptions(const HeadlessOptions& opts,
+                         SimulationSettings* settings)
+{
+    WorldSettings& ws = settings->world;
+    InhabitantsSettings& is = settings->inhabitants;
+
+    settings->seed = opts.seed;
+
+    if (opts.size > 0)
+    {
+        // Positions are stored in 16 bits
+        if ((size_t)opts.size > gMaxWorldSize)
+        {
+            return false;
+        }
+        ws.size = opts.size;
+        is.size = opts.size;
+    }
+
+    if (opts.density != f32Lowest)
+    {
+        // A fraction of the cells, with some of them inhabited
+        if (!(opts.density > 0.0f && opts.density <= 1.0f))
+        {
+            return false;
+        }
+        is.gMaxInhabitants = opts.density;
+    }
+
+    if (opts.intolerance >= 0.0f)
+    {
+        is.gIntoleranceFactor = opts.intolerance;
+    }
+
+    if (opts.archetypes > 0)
+    {
+        // As many as an ArchetypeIndex tells apart
+        if ((size_t)opts.archetypes > gMaxArchetypes)
+        {
+            return false;
+        }
+        is.SetArchetypeCount(opts.archetypes);
+    }
+
+    if (opts.fullSweep)
+    {
+        is.useActiveSet = false;
+    }
+
+    is.trackMetrics = opts.metrics;
+
+    is.convergence.trackUnhappy = opts.trackUnhappy;
+
+    if (opts.settled >= 0.0f)
+    {
+        is.convergence.settledFraction = opts.settled;
+    }
+
+    if (opts.cycleWindow >= 0)
+    {
+        is.convergence.cycleWindow = opts.cycleWindow;
+    }
+
+    if (opts.threads > 0)
+    {
+        is.threadCount = opts.threads;
+    }
+
+    if (opts.tileSize > 0)
+    {
+        is.tileSize = opts.tileSize;
+    }
+
+    if (opts.pageFile)
+    {
+        is.pageFile = opts.pageFile;
+        is.pagedChunks = opts.pagedChunks;
+    }
+
+    if (opts.mode)
+    {
+        if (strcmp(opts.mode, "sweep") == 0)
+        {
+            is.updateMode = EUpdateMode::Sweep;
+        }
+        else if (strcmp(opts.mode, "checkerboard") == 0)
+        {
+            is.updateMode = EUpdateMode::Checkerboard;
+        }
+        else if (strcmp(opts.mode, "sync") == 0)
+        {
+            is.updateMode = EUpdateMode::Synchronous;
+        }
+        else if (strcmp(opts.mode, "async") == 0)
+        {
+            is.updateMode = EUpdateMode::RandomSequential;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    if (opts.threshold != f32Lowest)
+    {
+        is.gHappinessThreshold = opts.threshold;
+    }
+
+    if (opts.movement)
+    {
+        if (strcmp(opts.movement, "adjacent") == 0)
+        {
+            is.movementMode = EMovementMode::Adjacent;
+        }
+        else if (strcmp(opts.movement, "global") == 0)
+        {
+            is.movementMode = EMovementMode::Global;
+        }
+        else if (strcmp(opts.movement, "best") == 0)
+        {
+            is.movementMode = EMovementMode::BestVacancy;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    if (opts.backend)
+    {
+        if (strcmp(opts.backend, "counts") == 0)
+        {
+            is.neighbourBackend = ENeighbourBackend::CountGrid;
+        }
+        else if (strcmp(opts.backend, "bitplanes") == 0)
+        {
+            is.neighbourBackend = ENeighbourBackend::BitPlanes;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    if (is.neighbourBackend == ENeighbourBackend::BitPlanes
+        && is.archetypes.size() > gMaxBitPlaneArchetypes)
+    {
+        return false;
+    }
+
+    if (!is.pageFile.empty() && !is.CanPage())
+    {
+        return false;
+    }
+
+    // Every inhabitant needs an id a cell can hold
+    if ((size_t)(is.size * is.size * is.gMaxInhabitants) > gMaxCellInhabitants)
+    {
+        return false;
+    }
+
+    if (opts.clusters && is.size * is.size >= gMaxClusterCells)
+    {
+        return false;
+    }
+
+    return is.tileSize >= 2;
+}
+
+static void DumpGrid(InhabitantSystem* system)
+{
+    for (int y = 0; y < (int)system->dimensions.y; y++)
+    {
+        for (int x = 0; x < (int)system->dimensions.x; x++)
+        {
+            InhabitantCell cell = system->CellAt(x, y);
+            if (cell.IsEmpty())
+            {
+                putchar('.');
+                continue;
+            }
+
+            int type = system->ArchetypeAt({ x, y }, cell.Id());
+            putchar(type < 10 ? '0' + type : 'a' + (type - 10));
+        }
+        putchar('\n');
+    }
+}
+
+int main(int argc, const char** argv)
+{
+    HeadlessOptions opts {};
+    if (!ParseOptions(argc, argv, &opts))
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    // Continuous time has no turns to converge, record or replay
+    bool continuous = opts.continuous >= 0.0;
+    if (continuous && (opts.converge || opts.record || opts.replay))
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    // A paged world is gone over row by row, these reach all across it
+    if (opts.pageFile
+        && (continuous || opts.record || opts.replay || opts.clusters))
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    if (!opts.seeded)
+    {
+        opts.seed = time(0);
+    }
+
+    SimulationSettings settings = GameSettings::Defaults();
+    if (!ApplyOptions(opts, &settings))
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    InhabitantsSettings& is = settings.inhabitants;
+
+    // A replay runs in the recorded world, with the other settings as given
+    MoveReplay replay = {};
+    if (opts.replay)
+    {
+        if (!MoveReplay::Open(opts.replay, &replay))
+        {
+            return 1;
+        }
+
+        settings.seed = replay.log.header.seed;
+        settings.world.size = replay.log.header.width;
+        is.size = replay.log.header.width;
+    }
+
+    assert(settings.world.size == (int)is.size);
+
+    auto populateStart = std::chrono::steady_clock::now();
+    SimulationContext context = {};
+    if (opts.load)
+    {
+        if (!Checkpoint::Load(opts.load, settings, &context))
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        context = SimulationContext::Create(settings);
+    }
+    auto populateEnd = std::chrono::steady_clock::now();
+
+    InhabitantSystem& system = context.inhabitants;
+
+    auto seekStart = std::chrono::steady_clock::now();
+    if (opts.replay && !replay.Seek(opts.seek, &system))
+    {
+        return 1;
+    }
+    auto seekEnd = std::chrono::steady_clock::now();
+
+    if (opts.record)
+    {
+        system.recorder = MoveRecorder::Create(opts.record, &system);
+        if (!system.recorder)
+        {
+            return 1;
+        }
+    }
+
+    EStopReason reason = EStopReason::MaxTurns;
+    GillespieEngine engine = {};
+
+    auto runStart = std::chrono::steady_clock::now();
+    if (continuous)
+    {
+        engine = GillespieEngine::Create(&system, opts.rate);
+        engine.Run(&system, opts.continuous, opts.events);
+    }
+    else if (opts.replay)
+    {
+        for (u64 turn = 0; turn < opts.turns; turn++)
+        {
+            if (!replay.StartNextTurn(&system))
+            {
+                break;
+            }
+            system.UpdateCellMovement(1.0f);
+        }
+    }
+    else if (opts.converge)
+    {
+        reason = system.RunUntilConverged(opts.turns).reason;
+    }
+    else
+    {
+        for (u64 turn = 0; turn < opts.turns; turn++)
+        {
+            system.StartNextTurn();
+
+            // A full step finishes the turn and applies every move
+            system.UpdateCellMovement(1.0f);
+        }
+    }
+
+    // Recording isn't done until the log is on disk
+    if (system.recorder)
+    {
+        system.recorder->Flush();
+    }
+    auto runEnd = std::chrono::steady_clock::now();
+
+    ConvergenceTracker& convergence = system.convergence;
+
+    u64 totalMoves = 0;
+    for (u64 moves : convergence.movesPerTurn)
+    {
+        totalMoves += moves;
+    }
+
+    u64 lastMoves = convergence.movesPerTurn.empty()
+                        ? 0 : convergence.movesPerTurn.back();
+    u64 lastEvaluated = system.useActiveSet
+                            ? system.activeCells.size()
+                            : system.CellCount();
+
+    f64 populateSeconds =
+        std::chrono::duration<f64>(populateEnd - populateStart).count();
+    f64 runSeconds = std::chrono::duration<f64>(runEnd - runStart).count();
+    f64 seekSeconds = std::chrono::duration<f64>(seekEnd - seekStart).count();
+
+    if (opts.dump)
+    {
+        DumpGrid(&system);
+    }
+
+    if (opts.save && !Checkpoint::Save(opts.save, &context))
+    {
+        return 1;
+    }
+
+    ClusterStats clusters = {};
+    f64 clusterSeconds = 0.0;
+    if (opts.clusters)
+    {
+        auto clusterStart = std::chrono::steady_clock::now();
+        clusters = ClusterStats::Compute(&system,
+                                         opts.clusters == 8
+                                            ? EConnectivity::Eight
+                                            : EConnectivity::Four);
+        clusterSeconds = std::chrono::duration<f64>(
+                    std::chrono::steady_clock::now() - clusterStart).count();
+    }
+
+    if (opts.clusters && opts.histogram)
+    {
+        FILE* file = fopen(opts.histogram, "w");
+        if (!file)
+        {
+            fprintf(stderr, "can't write %s\n", opts.histogram);
+            return 1;
+        }
+
+        fprintf(file, "size\tcount\n");
+        for (ClusterSizeCount& bin : clusters.histogram)
+        {
+            fprintf(file, "%llu\t%llu\n",
+                    (unsigned long long)bin.size,
+                    (unsigned long long)bin.count);
+        }
+        fclose(file);
+    }
+
+    printf("seed            %llu\n", (unsigned long long)system.seed);
+    printf("world           %zu x %zu\n",
+            system.dimensions.x, system.dimensions.y);
+    printf("archetypes      %zu\n", system.settings.archetypes.size());
+    printf("threads         %u\n", is.threadCount);
+    printf("inhabitants     %zu\n", system.inhabitants.Count());
+    printf("%s        %.3f s\n",
+            opts.load ? "restore " : "populate", populateSeconds);
+    if (opts.replay)
+    {
+        printf("seek            %.3f s\n", seekSeconds);
+    }
+    printf("turns           %llu\n", (unsigned long long)system.turnCount);
+    printf("total moves     %llu\n", (unsigned long long)totalMoves);
+    printf("last turn moves %llu\n", (unsigned long long)lastMoves);
+    printf("last turn cells %llu\n", (unsigned long long)lastEvaluated);
+    printf("state hash      %016llx\n", (unsigned long long)system.stateHash);
+    if (!convergence.unhappyFractions.empty())
+    {
+        printf("unhappy         %.4f\n", convergence.unhappyFractions.back());
+    }
+    if (opts.converge)
+    {
+        printf("stopped         %s\n", StopReasonName(reason));
+        if (reason == EStopReason::Cycle)
+        {
+            printf("cycle period    %llu\n",
+                    (unsigned long long)convergence.cyclePeriod);
+        }
+    }
+    if (system.trackMetrics)
+    {
+        SegregationMetrics& metrics = system.metrics;
+
+        printf("dissimilarity   %.4f\n", metrics.Dissimilarity());
+        printf("isolation      ");
+        for (size_t a = 0; a < metrics.archetypeCount; a++)
+        {
+            printf(" %.4f", metrics.Isolation(a));
+        }
+        printf("\n");
+        printf("mixed boundary  %llu\n",
+                (unsigned long long)metrics.MixedBoundary());
+        printf("happy           %.4f\n", metrics.HappyFraction());
+    }
+    if (opts.clusters)
+    {
+        printf("clusters        %zu\n", clusters.sizes.size());
+        printf("largest        ");
+        for (u64 largest : clusters.largest)
+        {
+            printf(" %llu", (unsigned long long)largest);
+        }
+        printf("\n");
+        printf("cluster time    %.3f s\n", clusterSeconds);
+    }
+    if (system.Paged())
+    {
+        ChunkPager& pager = *system.cells.pager;
+
+        // Every pager's chunks in memory, whatever they hold
+        size_t pagedBytes = 0;
+        for (ChunkPager* paged : { system.cells.pager.get(),
+                                   system.neighbourCounts.pager.get(),
+                                   system.cellArchetypes.pager.get(),
+                                   system.inhabitants.pager.get(),
+                                   context.world->tiles.pager.get() })
+        {
+            pagedBytes += paged ? paged->buffers.size() : 0;
+        }
+
+        printf("paged chunks    %zu of %zu\n",
+                pager.capacity, system.cells.ChunkCount());
+        printf("paged memory    %.1f MiB\n", pagedBytes / 1048576.0);
+        printf("chunk loads     %llu\n", (unsigned long long)pager.loads);
+        printf("chunk writes    %llu\n", (unsigned long long)pager.writes);
+    }
+    if (continuous)
+    {
+        printf("time            %.4f\n", engine.time);
+        printf("events          %llu\n", (unsigned long long)engine.events);
+        printf("event moves     %llu\n", (unsigned long long)engine.moves);
+        printf("total rate      %.1f\n", engine.rates.Total());
+        printf("events/sec      %.0f\n",
+                runSeconds > 0.0 ? engine.events / runSeconds : 0.0);
+    }
+    printf("run time        %.3f s\n", runSeconds);
+    printf("turns/sec       %.1f\n",
+            runSeconds > 0.0 ? system.turnCount / runSeconds : 0.0);
+
+    return 0;
+}
@@ -1,32 +1,129 @@
 #include "inhabitant.h"
+#include "movelog.h"
 
 #include <algorithm>
 #include <limits>
 #include <vector>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
 
-#include "raylib.h"
-#include "raymath.h"
-
-
-#include "gamesettings.h"
 
 InhabitantSystem 
-InhabitantSystem::Create()
+InhabitantSystem::Create(const InhabitantsSettings& iSettings, u64 seed)
 {
-    InhabitantsSettings& iSettings =
-                         GameSettings::inhabitantSettings;
 
+    assert(iSettings.size <= gMaxWorldSize);
+    assert(iSettings.archetypes.size() <= gMaxArchetypes);
+
+    V2<size_t> dimensions = { (size_t)iSettings.size,
+                              (size_t)iSettings.size };
+    size_t archetypeCount = iSettings.archetypes.size();
+
+    bool useCountGrid =
+        iSettings.neighbourBackend == ENeighbourBackend::CountGrid;
+
+    bool trackVacancies =
+        iSettings.movementMode == EMovementMode::Global;
+
+    bool indexVacancies =
+        iSettings.movementMode == EMovementMode::BestVacancy;
+
+    bool trackMetrics = iSettings.trackMetrics;
+
+    bool paged = !iSettings.pageFile.empty();
+    assert(!paged || iSettings.CanPage());
+
+    InhabitantSystem system = {
+        .settings = iSettings,
+        .dimensions = dimensions,
+
+        .cells = ChunkedGrid<InhabitantCell, CellLayout>::Create(dimensions),
+
+        .neighbourBackend = iSettings.neighbourBackend,
+        .useActiveSet = iSettings.useActiveSet && !paged,
+        .trackVacancies = trackVacancies,
+        .indexVacancies = indexVacancies,
+        .trackMetrics = trackMetrics,
+
+        .neighbourCounts = useCountGrid
+                            ? NeighbourCountGrid::Create(dimensions,
+                                                archetypeCount)
+                            : NeighbourCountGrid {},
+
+        .bitPlanes = useCountGrid
+                            ? BitPlaneGrid {}
+                            : BitPlaneGrid::Create(dimensions,
+                                                archetypeCount),
+
+        .proposedDirections = iSettings.updateMode == EUpdateMode::Synchronous
+                            ? std::vector<u8>(dimensions.x * dimensions.y, 0)
+                            : std::vector<u8> {},
+
+        .activeSet = iSettings.useActiveSet && !paged
+                            ? ActiveSet::Create(dimensions)
+                            : ActiveSet {},
+
+        .vacancies = trackVacancies
+                            ? CellSet::Create(dimensions.x * dimensions.y)
+                            : CellSet {},
 
-    return {
-        .dimensions = { (size_t)iSettings.size, 
-                         (size_t)iSettings.size },
+        .vacancyIndex = indexVacancies
+                            ? VacancyIndex::Create(dimensions.x * dimensions.y,
+                                                   archetypeCount)
+                            : VacancyIndex {},
 
-        .cells = std::vector<InhabitantCell>(iSettings.size * iSettings.size),
-                 
+        .pool = iSettings.threadCount > 1
+                    ? ThreadPool::Create(iSettings.threadCount - 1)
+                    : nullptr,
 
-        .reservations = std::vector<bool>(iSettings.size * iSettings.size, false),
+        .seed = seed,
+
+        .convergence = ConvergenceTracker::Create(iSettings.convergence),
+
+        .metrics = trackMetrics
+                            ? SegregationMetrics::Create(dimensions,
+                                                         archetypeCount)
+                            : SegregationMetrics {},
     };
+
+    if (!useCountGrid)
+    {
+        system.rowScores.resize(iSettings.threadCount,
+                        BitPlaneRowScores::Create(&system.bitPlanes));
+    }
+
+    // Cells are visited row major, by turns and by every pass over the
+    // grid, and everything else goes along with them. The columns too:
+    // ids follow row major order when populated and moves are short
+    if (paged)
+    {
+        const char* path = iSettings.pageFile.c_str();
+        size_t capacity = iSettings.PagedCapacity();
+
+        if (system.cells.Page(path, capacity))
+        {
+            system.cellArchetypes =
+                ChunkedGrid<ArchetypeIndex>::Create(dimensions);
+
+            bool pagedAll =
+                system.neighbourCounts.Page(path, capacity)
+                && system.cellArchetypes.Page(path, capacity)
+                && system.inhabitants.Page(path, gMaxCellInhabitants,
+                                           capacity);
+            if (!pagedAll)
+            {
+                fprintf(stderr, "can't page everything to %s\n", path);
+                abort();
+            }
+        }
+        else
+        {
+            fprintf(stderr, "keeping everything in memory\n");
+        }
+    }
+
+    return system;
 }
 
 void InhabitantSystem::StartNextTurn()
@@ -42,6 +139,88 @@ void InhabitantSystem::StartNextTurn()
     turnInProgress = true;
 }
 
+void InhabitantSystem::FinishTurn()
+{
+    f32 unhappyFraction = 0.0f;
+    if (convergence.MeasuresUnhappy() && inhabitants.Count() > 0)
+    {
+        u64 unhappy = trackMetrics
+                        ? inhabitants.Count() - metrics.happy
+                        : CountUnhappy();
+        unhappyFraction = (f32)unhappy / inhabitants.Count();
+    }
+
+    convergence.Record(movingInhabitants.size(), unhappyFraction, stateHash);
+
+    if (recorder)
+    {
+        recorder->RecordTurn(turnCount, movingInhabitants, inhabitants);
+    }
+
+    turnInProgress = false;
+    movesApplied = false;
+    movingInhabitants.clear();
+}
+
+ConvergenceResult InhabitantSystem::RunUntilConverged(u64 maxTurns)
+{
+    ConvergenceResult result = {};
+
+    // A half animated turn is finished first, it doesn't count
+    UpdateCellMovement(1.0f);
+
+    while (result.turns < maxTurns)
+    {
+        StartNextTurn();
+        UpdateCellMovement(1.0f);
+        result.turns++;
+
+        if (convergence.reason != EStopReason::Running)
+        {
+            result.reason = convergence.reason;
+            return result;
+        }
+    }
+
+    result.reason = EStopReason::MaxTurns;
+    return result;
+}
+
+u64 InhabitantSystem::CountUnhappy()
+{
+    InhabitantsSettings& iSettings = settings;
+
+    std::vector<u64> rowUnhappy(dimensions.y, 0);
+
+    ParallelForRows(1, [&](size_t y, u32)
+    {
+        for (size_t x = 0; x < dimensions.x; x++)
+        {
+            InhabitantCell cell = CellAt(x, y);
+            if (cell.IsEmpty())
+            {
+                continue;
+            }
+
+            V2<i32> position = { (i32)x, (i32)y };
+            ArchetypeIndex type = ArchetypeAt(position, cell.Id());
+
+            if (CalcCellScore(type, position, position)
+                    < iSettings.gHappinessThreshold)
+            {
+                rowUnhappy[y]++;
+            }
+        }
+    });
+
+    u64 unhappy = 0;
+    for (u64 count : rowUnhappy)
+    {
+        unhappy += count;
+    }
+    return unhappy;
+}
+
 bool InhabitantSystem::UpdateCellMovement(f32 dt)
 {
     if (!turnInProgress)
@@ -52,6 +231,9 @@ bool InhabitantSystem::UpdateCellMovement(f32 dt)
     movementProgress += dt;
     movementProgress = std::clamp<f32>(movementProgress, 0.0f, 1.0f);
 
+    // Nothing draws a paged system, it has no animation column
+    bool animated = !Paged();
+
     for (int i = 0; i < movingInhabitants.size(); i++)
     {
         MovingInhabitant moving = movingInhabitants[i];
@@ -61,32 +243,37 @@ bool InhabitantSystem::UpdateCellMovement(f32 dt)
         V2<i32> cOrigin = moving.origin;
         V2<i32> cDest = moving.destination;
 
-        Vector3 origin = {(float)cOrigin.x, 0, (float)cOrigin.y};
-        Vector3 destination = {(float)cDest.x, 0, (float)cDest.y};
+        V2<f32> origin = {(f32)cOrigin.x, (f32)cOrigin.y};
+        V2<f32> destination = {(f32)cDest.x, (f32)cDest.y};
 
         if (movementProgress < 1.0f)
         {
-            Vector3 pos = Vector3Lerp(origin,
+            V2<f32> pos = V2Lerp(origin,
                     destination,
                     movementProgress);
 
-            inhabitants[id].position = pos;
+            if (animated)
+            {
+                inhabitants.animation[id].position = pos;
+            }
         }
         else
         {
-            inhabitants[id].position = destination;
-
-            CellAt(cOrigin.x,cOrigin.y).inhabitantId = InvalidId;
-            CellAt(cDest.x, cDest.y).inhabitantId = id;
-
+            if (animated)
+            {
+                inhabitants.animation[id].position = destination;
+            }
+            if (!movesApplied)
+            {
+                ApplyMove(moving);
+            }
         }
         
     }
 
     if (movementProgress >= 1.0f)
     {
-        turnInProgress = false;
-        movingInhabitants.clear();
+        FinishTurn();
         return true;
     }
 
@@ -95,344 +282,1613 @@ bool InhabitantSystem::UpdateCellMovement(f32 dt)
 
 
 
-f32
-InhabitantSystem::CalcNeighbourScore ( Inhabitant* inhabitant,
-                                           V2<i32> position)
+void InhabitantSystem::ApplyMove(MovingInhabitant move)
 {
-    assert(inhabitant);
+    InhabitantID id = move.id;
 
-    InhabitantsSettings& iSettings =
-                         GameSettings::inhabitantSettings;
+    V2<i32> origin = move.origin;
+    V2<i32> dest = move.destination;
 
-    if (position.x < 0 || position.x >= iSettings.size)
+    ArchetypeIndex archetype = ArchetypeAt(origin, id);
+
+    // Measured while the destination is still empty
+    u64 happyBefore = 0;
+    if (trackMetrics)
     {
-        return 0;
+        happyBefore = CountHappyAround(origin, dest);
+        CountMetricPairs(origin, archetype, -1);
     }
 
-    if (position.y < 0 || position.y >= iSettings.size)
+    SetCellAt(origin.x, origin.y, {});
+    SetCellAt(dest.x, dest.y, InhabitantCell::Create(id));
+    inhabitants.SetPosition(id, dest);
+
+    if (Paged())
     {
-        return 0;
+        cellArchetypes.Set(dest.x, dest.y, archetype);
     }
 
-    InhabitantCell cell = CellAt(position.x, position.y);
+    stateHash ^= StateKey(CellIndex(origin.x, origin.y), archetype)
+               ^ StateKey(CellIndex(dest.x, dest.y), archetype);
+
+    if (neighbourBackend == ENeighbourBackend::BitPlanes)
+    {
+        bitPlanes.Clear(origin, archetype);
+        bitPlanes.Set(dest, archetype);
+    }
+    else
+    {
+        neighbourCounts.Remove(origin, archetype);
+        neighbourCounts.Add(dest, archetype);
+    }
 
-    if (!cell.IsEmpty())
+    if (trackMetrics)
     {
+        CountMetricPairs(dest, archetype, 1);
+        metrics.MoveBlock(origin, dest, archetype);
+        metrics.happy += CountHappyAround(origin, dest) - happyBefore;
+    }
 
-        V2<i32> inhabPosition = {(i32)inhabitant->position.x,
-                                (i32)inhabitant->position.z};
+    if (useActiveSet)
+    {
+        activeSet.MarkAround(origin);
+        activeSet.MarkAround(dest);
+    }
 
-        if (inhabPosition.x == position.x
-                && inhabPosition.y == position.y)
+    if (trackVacancies)
+    {
+        // A global destination already left the set when it was claimed
+        u32 destIndex = CellIndex(dest.x, dest.y);
+        if (vacancies.Contains(destIndex))
         {
-            //return 0.0;
+            vacancies.Remove(destIndex);
         }
 
-        Color inhabC = inhabitant->type.color;
-
-        Inhabitant inhabN = inhabitants[cell.inhabitantId];
-        Color neighC = inhabN.type.color;
+        vacancies.Insert(CellIndex(origin.x, origin.y));
+    }
 
-        bool same = ColorIsEqual(inhabC, neighC);
-        if (!same)
+    if (indexVacancies)
+    {
+        u32 destIndex = CellIndex(dest.x, dest.y);
+        if (vacancyIndex.Contains(destIndex))
         {
-            return -gIntoleranceFactor;
+            vacancyIndex.Remove(destIndex);
         }
-        else 
+
+        IndexVacancy(origin);
+
+        // Both cells changed the scores of the vacancies around them
+        for (V2<i32> centre : { origin, dest })
+        for (V2<i32> offset : gNeighbourOffsets)
         {
-            return gIntoleranceFactor;
+            V2<i32> p = { centre.x + offset.x, centre.y + offset.y };
+            if (p.x < 0 || p.x >= (i32)dimensions.x
+                || p.y < 0 || p.y >= (i32)dimensions.y)
+            {
+                continue;
+            }
+
+            if (vacancyIndex.Contains(CellIndex(p.x, p.y)))
+            {
+                IndexVacancy(p);
+            }
         }
+    }
+}
 
+
+void InhabitantSystem::IndexVacancy(V2<i32> position)
+{
+    u32 index = CellIndex(position.x, position.y);
+    for (size_t a = 0; a < vacancyIndex.archetypeCount; a++)
+    {
+        vacancyIndex.Set(index, a, NetScoreAt(a, position));
     }
-    else
+}
+
+
+f32 InhabitantSystem::ScoreFromNet(i32 net,
+                                   V2<i32> position,
+                                   V2<i32> origin)
+{
+    InhabitantsSettings& iSettings = settings;
+
+    // Same kind neighbour and occupied neighbour both one less
+    if (IsAdjacent(position, origin))
     {
-        return 0.0f;
+        net -= 1;
     }
+
+    return net * iSettings.gIntoleranceFactor;
 }
 
 
 f32
-InhabitantSystem::CalcCellScore ( Inhabitant* inhabitant,
-                                       V2<i32> position)
+InhabitantSystem::CalcCellScore ( ArchetypeIndex archetype,
+                                       V2<i32> position,
+                                       V2<i32> origin)
+{
+    return ScoreFromNet(NetScoreAt(archetype, position), position, origin);
+}
+
+
+template<typename NetFn>
+i32 InhabitantSystem::FindBetterNeighbours(V2<i32> position,
+                                           ArchetypeIndex currentType,
+                                           NetFn&& net,
+                                           bool reserve,
+                                           i32* bestDirs)
 {
-    InhabitantsSettings& iSettings =
-                         GameSettings::inhabitantSettings;
+    InhabitantsSettings& iSettings = settings;
 
     i32 x = position.x;
     i32 y = position.y;
 
-    f32 totalScore = 0.0f;
-
-    constexpr size_t dirCount = 4; 
-    V2<i32> adjascentScores[dirCount] = 
-    {
-        { V2<i32>::Up()},
-        { V2<i32>::Down() },
-        { V2<i32>::Right() },
-        { V2<i32>::Left() },
-    };
+    f32 bestScore = ScoreFromNet(net(currentType, position),
+                                 position, position);
 
+    i32 bestCount = 0;
 
-    for (int i = 0; i < 4; i++)
+    for (int i = 0; i < gNeighbourCount; i++)
     {
-        V2<i32> nextPos = { x + adjascentScores[i].x,
-                            y + adjascentScores[i].y
+        V2<i32> nextPos = { x + gNeighbourOffsets[i].x,
+                            y + gNeighbourOffsets[i].y
         };
         
         if (( nextPos.x < 0 || nextPos.x >= iSettings.size)
-            && (nextPos.y < 0 || nextPos.y >= iSettings.size))
+            || (nextPos.y < 0 || nextPos.y >= iSettings.size))
         {
             continue;
         }
-        
-        totalScore = CalcNeighbourScore(inhabitant,
-                                        nextPos);
+
+        if (!CellAt(nextPos.x, nextPos.y).IsEmpty()
+                || (reserve && GetReservationAt(nextPos.x, nextPos.y)))
+        {
+            continue;
+        }
+
+        f32 score = ScoreFromNet(net(currentType, nextPos),
+                                 nextPos, position);
+
+        // Only strictly better cells are worth moving to,
+        // equally good ones are picked from at random
+        if (score > bestScore)
+        {
+            bestScore = score;
+            bestDirs[0] = i;
+            bestCount = 1;
+        }
+        else if (bestCount > 0 && score == bestScore)
+        {
+            bestDirs[bestCount++] = i;
+        }
     }
 
-    return totalScore;
+    return bestCount;
 }
 
-
-struct SchellingScoreData
+i32 InhabitantSystem::BetterNeighbours(V2<i32> position, i32* directions)
 {
-    V2<i32> direction;
-    f32 score;
-};
+    InhabitantCell cell = CellAt(position.x, position.y);
+    assert(!cell.IsEmpty());
 
-void InhabitantSystem::UpdateSchelling(int frameCount)
+    auto net = [this](ArchetypeIndex archetype, V2<i32> at)
+    {
+        return NetScoreAt(archetype, at);
+    };
+
+    return FindBetterNeighbours(position, ArchetypeAt(position, cell.Id()),
+                                net, false, directions);
+}
+
+bool InhabitantSystem::HasBetterNeighbour(V2<i32> position)
 {
+    InhabitantCell cell = CellAt(position.x, position.y);
+    assert(!cell.IsEmpty());
 
-    InhabitantsSettings& iSettings =
-                         GameSettings::inhabitantSettings;
-    // Zero rezervations
-    reservations.assign(reservations.size(), false);
+    ArchetypeIndex type = ArchetypeAt(position, cell.Id());
+    f32 score = ScoreFromNet(NetScoreAt(type, position), position, position);
 
-    for (int x = 0; x < iSettings.size; x++)
-    for (int y = 0; y < iSettings.size; y++)
+    for (int i = 0; i < gNeighbourCount; i++)
     {
-        InhabitantCell cell = CellAt(x, y);
-        // None there let's continue
-        if (cell.IsEmpty())
+        V2<i32> next = { position.x + gNeighbourOffsets[i].x,
+                         position.y + gNeighbourOffsets[i].y };
+
+        if (next.x < 0 || next.x >= (i32)dimensions.x
+            || next.y < 0 || next.y >= (i32)dimensions.y
+            || !CellAt(next.x, next.y).IsEmpty())
         {
             continue;
         }
 
+        if (ScoreFromNet(NetScoreAt(type, next), next, position) > score)
+        {
+            return true;
+        }
+    }
 
+    return false;
+}
 
-        constexpr i16 dirCount = 4; 
-        // Left, Right, Down, Up
-        SchellingScoreData scores[dirCount] = 
-        {
-            { V2<i32>::Up(),    0},
-            { V2<i32>::Down(),  0},
-            { V2<i32>::Right(), 0},
-            { V2<i32>::Left(),  0},
-        };
+template<typename NetFn>
+void InhabitantSystem::UpdateCell( V2<i32> position,
+                                   NetFn&& net,
+                                   std::vector<MovingInhabitant>* moves,
+                                   bool reserve)
+{
+    i32 x = position.x;
+    i32 y = position.y;
 
-        Inhabitant* currentInhab = &inhabitants[cell.inhabitantId];
+    InhabitantCell cell = CellAt(x, y);
+    // None there let's continue
+    if (cell.IsEmpty())
+    {
+        return;
+    }
 
-        for (int i = 0; i < dirCount; i++)
-        {
-            V2<i32> nextPos = { x + scores[i].direction.x,
-                                y + scores[i].direction.y
-            };
-            
-            if (( nextPos.x < 0 || nextPos.x >= iSettings.size)
-                || (nextPos.y < 0 || nextPos.y >= iSettings.size))
-            {
-                scores[i].score = f32Min;
-                continue;
-            }
+    // Directions sharing the best score
+    i32 bestDirs[gNeighbourCount] = {};
+    i32 bestCount = FindBetterNeighbours(position,
+                                         ArchetypeAt(position, cell.Id()),
+                                         net, reserve, bestDirs);
+    if (bestCount == 0)
+    {
+        return;
+    }
 
-            if (!CellAt(nextPos.x, nextPos.y).IsEmpty()
-                    || GetReservationAt(nextPos.x, nextPos.y))
-            {
-                scores[i].score = f32Min;
-                continue;
-            }
+    i32 moveDir = bestDirs[0];
+    if (bestCount > 1)
+    {
+        // Keyed by turn and cell, the same whichever thread gets here
+        u32 random = RandomAt(seed, turnCount, CellIndex(x, y));
+        moveDir = bestDirs[random % bestCount];
+    }
 
-            scores[i].score = CalcCellScore(currentInhab,
-                                                    nextPos);
-        }
+    V2<i32> direction = gNeighbourOffsets[moveDir];
+    V2<i32> nextPos = {x + direction.x, y + direction.y};
 
-        // Sort the results
-        std::sort(std::begin(scores), std::end(scores),
-                [](auto& A, auto&B) {return A.score < B.score;});
+    InhabitantID id = cell.Id();
 
-        f32 currentScore = CalcCellScore(currentInhab, {x, y});
-        i32 moveDir = -1;
+    // Paged columns aren't shared with the other threads
+    assert(Paged() || (inhabitants.PositionOf(id).x == x
+                       && inhabitants.PositionOf(id).y == y));
 
-        for (int i = 0; i < dirCount; i++)
-        {
+    assert(CellAt(nextPos.x, nextPos.y).IsEmpty());
 
-            float nScore = scores[i].score;
-            if (nScore == f32Min) 
-            {
-                // Can't move to min float
-                break;
-            }
-            else if (currentScore > nScore)
-            {
-                break;
-            }
-            else if (nScore == currentScore)
+    moves->push_back({.id = id,
+                      .destination = nextPos,
+                      .origin = position});
+
+    if (reserve)
+    {
+        SetReservationAt(nextPos.x, nextPos.y, true);
+    }
+}
+
+
+void InhabitantSystem::NextReservationStamp()
+{
+    if (reservationStamp + 1 < gReservationStamps)
+    {
+        reservationStamp++;
+        return;
+    }
+
+    // Stamps are about to be reused, a cell keeping one from back then
+    // would look reserved
+    ParallelForRows(gChunkSize, [&](size_t chunkRow, u32)
+    {
+        size_t first = chunkRow * cells.chunksPerRow;
+        for (size_t chunk = first; chunk < first + cells.chunksPerRow;
+             chunk++)
+        {
+            if (!cells.HoldsData(chunk))
             {
-                if (rand() % 2 > 0)
-                {
-                    moveDir = i;
-                }
-                else
-                {
-                    break;
-                }
+                continue;
             }
-            else if (currentScore < nScore)
+
+            InhabitantCell* data = cells.WritableChunk(chunk);
+            for (size_t i = 0; i < gChunkCells; i++)
             {
-                moveDir = i;
+                data[i].SetStamp(0);
             }
         }
+    });
 
+    reservationStamp = 1;
+}
 
-        // If we have direction
-        if (moveDir >= 0)
-        {
-            V2<i32> direction = scores[moveDir].direction;
-            V2<i32> nextPos = {x + direction.x, y + direction.y};
-
-            InhabitantID id = cell.inhabitantId;
 
-            Inhabitant in = inhabitants[id];
-            V2<i32> iPos = {(i32)std::round(in.position.x),
-                            (i32)std::round(in.position.z)};
-            V2<i32> oPos = {x, y};
+void InhabitantSystem::UpdateSchelling(int frameCount)
+{
+    InhabitantsSettings& iSettings = settings;
 
-            assert(iPos.x == oPos.x && iPos.y == iPos.y);
+    NextReservationStamp();
 
-            assert(CellAt(nextPos.x, nextPos.y).IsEmpty());
+    if (useActiveSet)
+    {
+        activeSet.Take(&activeCells);
+    }
 
-            movingInhabitants.push_back({.id = id,
-                                            .destination = nextPos,
-                                            .origin = {x, y}});
+    if (iSettings.movementMode == EMovementMode::Global)
+    {
+        // Any move can claim any vacancy, there is nothing to split up
+        UpdateGlobal();
+    }
+    else if (iSettings.movementMode == EMovementMode::BestVacancy)
+    {
+        UpdateBestVacancy();
+    }
+    else switch (iSettings.updateMode)
+    {
+        case EUpdateMode::Sweep:
+            UpdateSweep();
+            break;
 
-            SetReservationAt(nextPos.x, nextPos.y, true);
-        }
+        case EUpdateMode::Checkerboard:
+            UpdateCheckerboard();
+            break;
 
-    }  // End cell iteration
+        case EUpdateMode::Synchronous:
+            UpdateSynchronous();
+            break;
 
+        case EUpdateMode::RandomSequential:
+            UpdateRandomSequential();
+            break;
+    }
 
+#ifndef NDEBUG
     // Sanity check
     for (int i = 0; i < movingInhabitants.size(); i++)
     {
         MovingInhabitant mv = movingInhabitants[i];
-        Inhabitant in = inhabitants[mv.id];
-        V2<i32> oPos = mv.origin;
-        V2<i32> iPos = {(i32)in.position.x, (i32)in.position.z};
+        V2<i32> oPos = movesApplied ? mv.destination : mv.origin;
+        V2<i32> iPos = inhabitants.PositionOf(mv.id);
 
         assert (oPos.x == iPos.x);
         assert (oPos.y == iPos.y);
     }
-
-
+#endif
 };
 
-void InhabitantSystem::Draw(AABB<i32> box, Resources* r)
-{
-    Model m = r->models["InhabitantToken"];
 
-    for (int i = box.xMin; i < box.xMax; ++i)
-    for (int j = box.yMin; j < box.yMax; ++j)
+template<typename VisitFn>
+void InhabitantSystem::ForEachCell(VisitFn&& visit)
+{
+    if (useActiveSet)
     {
-        InhabitantCell cell = CellAt(i,j);
-
-        if (cell.IsEmpty())
+        for (u32 index : activeCells)
         {
-            continue;
+            visit(CellPosition(index));
         }
+        return;
+    }
 
-        Inhabitant inh = inhabitants[cell.inhabitantId];
-
-        Vector3 drawPos = {inh.position.x,  0.1f, inh.position.z};
-
-        DrawModel(m, drawPos, 1.0f, inh.type.color);
+    // Row major, the order cells are laid out in memory
+    for (int y = 0; y < (i32)dimensions.y; y++)
+    for (int x = 0; x < (i32)dimensions.x; x++)
+    {
+        visit(V2<i32>{x, y});
     }
 }
 
 
-void InhabitantSystem::Populate()
+// Below one visited cell in this many, the bit plane backend scores
+// cells one at a time instead of filling whole rows
+constexpr size_t gBatchedScoringRatio = 16;
+
+void InhabitantSystem::UpdateSweep()
 {
-    InhabitantsSettings& iSettings =
-                         GameSettings::inhabitantSettings;
+    // Filling whole rows only pays off when most cells get visited
+    bool batched = !useActiveSet
+                || activeCells.size() * gBatchedScoringRatio > CellCount();
 
-    int max = iSettings.size * iSettings.size * gMaxInhabitants;
-    for (int i = 0; i < max; ++i)
+    if (neighbourBackend == ENeighbourBackend::BitPlanes && batched)
     {
+        // Score three rows 64 cells at a time, then look them up
+        BitPlaneRowScores& scores = rowScores[0];
+        scores.Reset(0, bitPlanes.wordsPerRow);
 
-        do
+        auto net = [&scores](ArchetypeIndex archetype, V2<i32> position)
         {
-            int posX = rand() % iSettings.size;
-            int posY = rand() % iSettings.size;
+            return scores.NetAt(archetype, position.x, position.y);
+        };
 
+        ForEachCell([&](V2<i32> position)
+        {
+            scores.Prepare(&bitPlanes, position.y);
+            UpdateCell(position, net, &movingInhabitants);
+        });
+        return;
+    }
 
-            InhabitantCell existingInhabitant = CellAt(posX, posY);
+    auto net = [this](ArchetypeIndex archetype, V2<i32> position)
+    {
+        return NetScoreAt(archetype, position);
+    };
 
-            if (!existingInhabitant.IsEmpty())
-            {
-                continue;
-            }
-            else
-            {
-                //printf("Creating inhabitant %i at %u %u\n",
-                        //i, posX, posY);
+    if (!Paged())
+    {
+        ForEachCell([&](V2<i32> position)
+        {
+            UpdateCell(position, net, &movingInhabitants);
+        });
+        return;
+    }
 
-                int maxTypes = iSettings.archetypes.size();
-                int iType = rand() % maxTypes;
-                InhabitantArchetype type = iSettings.archetypes[iType];
+    // Applying the moves in a pass of their own would page every chunk in
+    // a second time. A move changes cells and counts at most two rows from
+    // its origin and a decision reads one row around its cell, so a move
+    // three rows behind the last decided row can be applied right away.
+    // Moves go in the order they were decided, as at the end of the turn
+    size_t applied = 0;
+    for (int y = 0; y < (i32)dimensions.y; y++)
+    {
+        for (int x = 0; x < (i32)dimensions.x; x++)
+        {
+            UpdateCell(V2<i32>{x, y}, net, &movingInhabitants);
+        }
 
-                Inhabitant inhab = {
-                            .type = type,
-                            .position = {(f32)posX, 0.0, (f32)posY}
-                };
+        while (applied < movingInhabitants.size()
+               && movingInhabitants[applied].origin.y + 3 <= y)
+        {
+            ApplyMove(movingInhabitants[applied++]);
+        }
+    }
 
-                V2<i32> iPos = {(i32)inhab.position.x, (i32)inhab.position.z};
-                V2<i32> oPos = {posX, posY};
+    for (; applied < movingInhabitants.size(); applied++)
+    {
+        ApplyMove(movingInhabitants[applied]);
+    }
 
+    movesApplied = true;
+}
 
-                assert(iPos.x == oPos.x && iPos.y == iPos.y);
 
-                InhabitantID id = inhabitants.size();
-                inhabitants.push_back(inhab);
-                    
+// An inhabitant only reads and reserves cells at most one step away, so
+// everything a tile touches lies in the tile grown by one cell. Tiles of
+// the same phase have a whole tile between them; with tiles of side 2 or
+// more those grown areas never overlap. Hence, within a phase:
+//  - no cell is read by one thread while another thread writes it,
+//  - no destination can be reserved twice.
+// Phases run one after another, so a tile sees every reservation made by
+// the earlier phases, exactly like an earlier cell in the serial sweep.
+// The only ordering difference to Sweep is which inhabitant wins a
+// contested cell: the one whose tile has the earlier phase, then the
+// earlier cell in row major order inside the tile.
+// Moves are merged in tile order, so the result does not depend on
+// the thread count.
+void InhabitantSystem::UpdateCheckerboard()
+{
+    InhabitantsSettings& iSettings = settings;
+
+    i32 tileSize = iSettings.tileSize;
+    assert(tileSize >= 2);
+
+    i32 size = iSettings.size;
+    i32 tilesX = (size + tileSize - 1) / tileSize;
+    i32 tilesY = tilesX;
+
+    tileMoves.resize(tilesX * tilesY);
+
+    // Reservations write cells, threads mustn't meet allocating a chunk
+    if (pool && !Paged())
+    {
+        for (size_t chunk = 0; chunk < cells.ChunkCount(); chunk++)
+        {
+            cells.Allocate(chunk);
+        }
+    }
+
+    // Active cells handed to their tiles, still row major within a tile
+    if (useActiveSet)
+    {
+        tileActive.resize(tilesX * tilesY);
+
+        for (u32 index : activeCells)
+        {
+            V2<i32> position = CellPosition(index);
+            size_t tile = (position.y / tileSize) * tilesX
+                        + (position.x / tileSize);
+            tileActive[tile].push_back(index);
+        }
+    }
 
+    auto updateTile = [&](i32 tx, i32 ty, u32 slot)
+    {
+        size_t tile = ty * tilesX + tx;
 
-                InhabitantCell newCell {};
-                newCell = { .inhabitantId = id};
+        i32 xBegin = tx * tileSize;
+        i32 yBegin = ty * tileSize;
+        i32 xEnd = std::min(size, (tx + 1) * tileSize);
+        i32 yEnd = std::min(size, (ty + 1) * tileSize);
 
-                CellAt(posX, posY) = newCell;
+        auto sweepTile = [&](auto&& visit)
+        {
+            if (useActiveSet)
+            {
+                for (u32 index : tileActive[tile])
+                {
+                    visit(CellPosition(index));
+                }
+                tileActive[tile].clear();
+                return;
+            }
 
-                break;
+            for (int y = yBegin; y < yEnd; y++)
+            for (int x = xBegin; x < xEnd; x++)
+            {
+                visit(V2<i32>{x, y});
             }
+        };
+
+        size_t tileCells = (xEnd - xBegin) * (yEnd - yBegin);
+        bool batched = !useActiveSet
+            || tileActive[tile].size() * gBatchedScoringRatio > tileCells;
+
+        if (neighbourBackend == ENeighbourBackend::BitPlanes && batched)
+        {
+            // Words covering the tile, the cells just left and right
+            // of it are scored one by one
+            BitPlaneRowScores& scores = rowScores[slot];
+            scores.Reset(xBegin >> 6, ((xEnd - 1) >> 6) + 1);
+
+            auto net = [this, &scores](ArchetypeIndex archetype,
+                                       V2<i32> position)
+            {
+                if (!scores.HoldsColumn(position.x))
+                {
+                    return bitPlanes.NetAt(archetype,
+                                           position.x, position.y);
+                }
+                return scores.NetAt(archetype, position.x, position.y);
+            };
+
+            sweepTile([&](V2<i32> position)
+            {
+                scores.Prepare(&bitPlanes, position.y);
+                UpdateCell(position, net, &tileMoves[tile]);
+            });
+            return;
         }
-        while (true);
 
-        // Sanity Check
+        auto net = [this](ArchetypeIndex archetype, V2<i32> position)
+        {
+            return NetScoreAt(archetype, position);
+        };
 
-        for (int x = 0; x < iSettings.size; x++)
-        for (int y = 0; y < iSettings.size; y++)
+        sweepTile([&](V2<i32> position)
         {
-            InhabitantCell cell = CellAt(x, y);
-            if (cell.IsEmpty())
+            UpdateCell(position, net, &tileMoves[tile]);
+        });
+    };
+
+    // Moves go in tile order
+    auto takeMoves = [&](size_t firstTile, size_t endTile, bool apply)
+    {
+        for (size_t tile = firstTile; tile < endTile; tile++)
+        {
+            std::vector<MovingInhabitant>& moves = tileMoves[tile];
+            for (MovingInhabitant move : moves)
+            {
+                if (apply)
+                {
+                    ApplyMove(move);
+                }
+                movingInhabitants.push_back(move);
+            }
+            moves.clear();
+        }
+    };
+
+    if (!Paged())
+    {
+        for (int phase = 0; phase < 4; phase++)
+        {
+            i32 phaseX = phase & 1;
+            i32 phaseY = phase >> 1;
+
+            i32 phaseTilesX = (tilesX - phaseX + 1) / 2;
+            i32 phaseTilesY = (tilesY - phaseY + 1) / 2;
+
+            ParallelFor(phaseTilesX * phaseTilesY, [&](size_t i, u32 slot)
+            {
+                updateTile(phaseX + (i % phaseTilesX) * 2,
+                           phaseY + (i / phaseTilesX) * 2, slot);
+            });
+        }
+
+        takeMoves(0, tileMoves.size(), false);
+        return;
+    }
+
+    // A paged grid is gone over once per turn: tile row 2m with phases 0
+    // and 1, then tile row 2m - 1 with phases 2 and 3 next to it, and so
+    // on down. Every tile still runs after the tiles of earlier phases
+    // around it, so the moves are the same as phase by phase. A tile row
+    // is shared while its tiles run, with the row either side of it their
+    // decisions read.
+    // As in the paged sweep, moves are applied once the decided rows are
+    // three past their origins, whole tile rows at a time
+    // Tiles of phase in tile row ty, which has to be one of its rows
+    auto updatePhase = [&](int phase, i32 ty)
+    {
+        i32 phaseX = phase & 1;
+        i32 phaseTilesX = (tilesX - phaseX + 1) / 2;
+
+        ParallelFor(phaseTilesX, [&](size_t i, u32 slot)
+        {
+            updateTile(phaseX + i * 2, ty, slot);
+        });
+    };
+
+    auto updateTileRow = [&](i32 ty, int firstPhase)
+    {
+        if (ty < 0 || ty >= tilesY)
+        {
+            return;
+        }
+
+        i32 yBegin = std::max(0, ty * tileSize - 1);
+        i32 yEnd = std::min(size, (ty + 1) * tileSize + 1);
+        ShareChunkRows(yBegin >> gChunkShift,
+                       ((yEnd - 1) >> gChunkShift) + 1);
+
+        updatePhase(firstPhase, ty);
+        updatePhase(firstPhase + 1, ty);
+
+        EndShare();
+    };
+
+    i32 appliedRows = 0;
+    for (i32 evenRow = 0; evenRow - 1 < tilesY; evenRow += 2)
+    {
+        updateTileRow(evenRow, 0);
+        updateTileRow(evenRow - 1, 2);
+
+        i32 decidedEnd = std::min(size, (evenRow + 1) * tileSize);
+        while (appliedRows < tilesY
+               && std::min(size, (appliedRows + 1) * tileSize) + 2
+                      < decidedEnd)
+        {
+            takeMoves(appliedRows * tilesX, (appliedRows + 1) * tilesX,
+                      true);
+            appliedRows++;
+        }
+    }
+
+    takeMoves(appliedRows * tilesX, tileMoves.size(), true);
+    movesApplied = true;
+}
+
+
+// Cells proposed from by one synchronous slice
+constexpr size_t gSyncSliceCells = 4096;
+
+// Two phases, each parallel over slices of the cells to visit:
+//  1. Every inhabitant picks its move like UpdateCell does, against the
+//     grid as it was when the turn started, no reservations.
+//  2. Every proposal looks at the other cells next to its destination.
+//     It is dropped if any of them proposed the same destination and
+//     outranks it.
+// Phase 1 only writes to proposals of its own cells, phase 2 only reads,
+// so neither depends on how slices are spread over threads. Winners
+// keep the row major order of their origins, like Sweep.
+void InhabitantSystem::UpdateSynchronous()
+{
+    size_t visits = useActiveSet ? activeCells.size() : CellCount();
+    size_t slices = (visits + gSyncSliceCells - 1) / gSyncSliceCells;
+
+    tileMoves.resize(std::max(tileMoves.size(), slices));
+
+    ParallelFor(slices, [&](size_t slice, u32 slot)
+    {
+        size_t begin = slice * gSyncSliceCells;
+        size_t end = std::min(visits, begin + gSyncSliceCells);
+
+        auto visit = [&](auto&& net)
+        {
+            for (size_t i = begin; i < end; i++)
+            {
+                u32 index = useActiveSet ? activeCells[i] : i;
+                UpdateCell(CellPosition(index), net, &tileMoves[slice],
+                           false);
+            }
+        };
+
+        bool batched = !useActiveSet
+            || activeCells.size() * gBatchedScoringRatio > CellCount();
+
+        if (neighbourBackend == ENeighbourBackend::BitPlanes && batched)
+        {
+            BitPlaneRowScores& scores = rowScores[slot];
+            scores.Reset(0, bitPlanes.wordsPerRow);
+
+            visit([&](ArchetypeIndex archetype, V2<i32> position)
+            {
+                scores.Prepare(&bitPlanes, position.y);
+                return scores.NetAt(archetype, position.x, position.y);
+            });
+        }
+        else
+        {
+            visit([this](ArchetypeIndex archetype, V2<i32> position)
+            {
+                return NetScoreAt(archetype, position);
+            });
+        }
+
+        for (MovingInhabitant& move : tileMoves[slice])
+        {
+            V2<i32> step = { move.destination.x - move.origin.x,
+                             move.destination.y - move.origin.y };
+            for (int i = 0; i < gNeighbourCount; i++)
+            {
+                if (gNeighbourOffsets[i].x == step.x
+                    && gNeighbourOffsets[i].y == step.y)
+                {
+                    proposedDirections[CellIndex(move.origin.x,
+                                                 move.origin.y)] = i + 1;
+                }
+            }
+        }
+    });
+
+    i32 size = settings.size;
+
+    ParallelFor(slices, [&](size_t slice, u32)
+    {
+        for (MovingInhabitant& move : tileMoves[slice])
+        {
+            V2<i32> destination = move.destination;
+            u32 origin = CellIndex(move.origin.x, move.origin.y);
+
+            for (int i = 0; i < gNeighbourCount; i++)
+            {
+                V2<i32> rival = { destination.x + gNeighbourOffsets[i].x,
+                                  destination.y + gNeighbourOffsets[i].y };
+                if (rival.x < 0 || rival.x >= size
+                    || rival.y < 0 || rival.y >= size)
+                {
+                    continue;
+                }
+
+                u32 rivalCell = CellIndex(rival.x, rival.y);
+                u8 proposed = proposedDirections[rivalCell];
+                if (rivalCell == origin || proposed == 0)
+                {
+                    continue;
+                }
+
+                V2<i32> step = gNeighbourOffsets[proposed - 1];
+                if (rival.x + step.x == destination.x
+                    && rival.y + step.y == destination.y
+                    && OutranksAt(rivalCell, origin))
+                {
+                    move.id = InvalidId;
+                    break;
+                }
+            }
+        }
+    });
+
+    for (size_t slice = 0; slice < slices; slice++)
+    {
+        for (MovingInhabitant& move : tileMoves[slice])
+        {
+            proposedDirections[CellIndex(move.origin.x, move.origin.y)] = 0;
+            if (move.id != InvalidId)
+            {
+                movingInhabitants.push_back(move);
+            }
+        }
+        tileMoves[slice].clear();
+    }
+}
+
+bool InhabitantSystem::OutranksAt(u32 cell, u32 other)
+{
+    // The second number of the cell's turn stream, the first one breaks
+    // ties between directions
+    RandomStream cellRandom = RandomStream::Create(seed, turnCount, cell);
+    RandomStream otherRandom = RandomStream::Create(seed, turnCount, other);
+    cellRandom.Next();
+    otherRandom.Next();
+
+    u32 priority = cellRandom.Next();
+    u32 otherPriority = otherRandom.Next();
+    if (priority != otherPriority)
+    {
+        return priority > otherPriority;
+    }
+    return cell < other;
+}
+
+
+// Inhabitant ids shuffled by one slice, and at most this many buckets,
+// which keeps the bucket counts at a sixteenth of the inhabitants
+constexpr size_t gShuffleSliceIds = 1 << 16;
+constexpr u32 gMaxShuffleBucketBits = 12;
+
+// A random sort: every id gets a 36 bit random key above its 28 bits,
+// so entries are unique and sorting them is a uniform shuffle (up to
+// the rare equal keys, which keep id order). Entries are spread into
+// buckets by their top bits, a parallel counting pass then a parallel
+// scatter, and each bucket is sorted on its own. No step is serial over
+// the inhabitants, and as every key is a pure function of seed, turn
+// and id the order doesn't depend on the thread count.
+void InhabitantSystem::ShuffleVisitOrder()
+{
+    static_assert(gCellIdBits <= 32);
+
+    size_t count = inhabitants.Count();
+    size_t slices = (count + gShuffleSliceIds - 1) / gShuffleSliceIds;
+
+    // Around 256 entries a bucket
+    u32 bucketBits = 0;
+    while (bucketBits < gMaxShuffleBucketBits
+           && ((size_t)256 << bucketBits) < count)
+    {
+        bucketBits++;
+    }
+    size_t buckets = (size_t)1 << bucketBits;
+
+    u64 key = InhabitantKey(seed);
+    auto entryOf = [&](size_t id)
+    {
+        RandomStream random = RandomStream::Create(key, turnCount, id);
+        u64 high = random.Next();
+        u64 bits = (high << 32) | random.Next();
+        return (bits & ~(u64)gCellIdMask) | id;
+    };
+
+    auto bucketOf = [&](u64 entry)
+    {
+        return bucketBits == 0 ? 0 : (size_t)(entry >> (64 - bucketBits));
+    };
+
+    visitOrder.resize(count);
+    bucketCounts.assign(slices * buckets, 0);
+
+    ParallelFor(slices, [&](size_t slice, u32)
+    {
+        u32* counts = bucketCounts.data() + slice * buckets;
+        size_t end = std::min(count, (slice + 1) * gShuffleSliceIds);
+
+        for (size_t id = slice * gShuffleSliceIds; id < end; id++)
+        {
+            counts[bucketOf(entryOf(id))]++;
+        }
+    });
+
+    // Where each slice starts writing in each bucket, slices in order
+    std::vector<size_t> bucketStarts(buckets + 1, 0);
+    u32 written = 0;
+    for (size_t bucket = 0; bucket < buckets; bucket++)
+    {
+        bucketStarts[bucket] = written;
+        for (size_t slice = 0; slice < slices; slice++)
+        {
+            u32& counted = bucketCounts[slice * buckets + bucket];
+            u32 sliceCount = counted;
+            counted = written;
+            written += sliceCount;
+        }
+    }
+    bucketStarts[buckets] = written;
+
+    // Keys are drawn again rather than kept, a second array as long as
+    // the order costs more than the draws
+    ParallelFor(slices, [&](size_t slice, u32)
+    {
+        u32* offsets = bucketCounts.data() + slice * buckets;
+        size_t end = std::min(count, (slice + 1) * gShuffleSliceIds);
+
+        for (size_t id = slice * gShuffleSliceIds; id < end; id++)
+        {
+            u64 entry = entryOf(id);
+            visitOrder[offsets[bucketOf(entry)]++] = entry;
+        }
+    });
+
+    ParallelFor(buckets, [&](size_t bucket, u32)
+    {
+        std::sort(visitOrder.begin() + bucketStarts[bucket],
+                  visitOrder.begin() + bucketStarts[bucket + 1]);
+    });
+}
+
+// Visits ahead the random sequential mode prefetches for
+constexpr size_t gColumnsAhead = 32;
+constexpr size_t gCellsAhead = 16;
+
+// Asynchronous updating: inhabitants one after another in a random order,
+// each seeing every move made before it this turn. Nothing is reserved,
+// the cells themselves are always up to date. Scoring is serial, only
+// the shuffle runs in parallel.
+//
+// Everyone moves at most once a turn, but may move into a cell left
+// earlier in the same turn. Replay orders such moves after the one they
+// follow (see replay.cpp).
+void InhabitantSystem::UpdateRandomSequential()
+{
+    ShuffleVisitOrder();
+
+    auto net = [this](ArchetypeIndex archetype, V2<i32> position)
+    {
+        return NetScoreAt(archetype, position);
+    };
+
+    auto idAt = [this](size_t i)
+    {
+        return (InhabitantID)(visitOrder[i] & gCellIdMask);
+    };
+
+    // Every visit lands somewhere random in memory. But the order is known
+    // and an inhabitant only moves on its own visit, so where it will be
+    // is known too: its columns are fetched well ahead, then the cells and
+    // counts around it
+    size_t count = visitOrder.size();
+    for (size_t i = 0; i < count; i++)
+    {
+        if (i + gColumnsAhead < count)
+        {
+            InhabitantID ahead = idAt(i + gColumnsAhead);
+            __builtin_prefetch(&inhabitants.x[ahead]);
+            __builtin_prefetch(&inhabitants.y[ahead]);
+            __builtin_prefetch(&inhabitants.archetype[ahead]);
+        }
+
+        if (i + gCellsAhead < count)
+        {
+            V2<i32> ahead = inhabitants.PositionOf(idAt(i + gCellsAhead));
+            for (i32 y = std::max(0, ahead.y - 1);
+                 y <= std::min((i32)dimensions.y - 1, ahead.y + 1); y++)
+            {
+                cells.Prefetch(ahead.x, y);
+            }
+
+            if (neighbourBackend == ENeighbourBackend::CountGrid)
+            {
+                neighbourCounts.Prefetch(ahead.x, ahead.y);
+            }
+        }
+
+        InhabitantID id = idAt(i);
+
+        size_t moved = movingInhabitants.size();
+        UpdateCell(inhabitants.PositionOf(id), net, &movingInhabitants,
+                   false);
+
+        if (movingInhabitants.size() > moved)
+        {
+            ApplyMove(movingInhabitants.back());
+        }
+    }
+
+    movesApplied = true;
+}
+
+
+// Classic schelling relocation: an unhappy inhabitant moves to a vacancy
+// picked uniformly from the whole world, whether it's better or not.
+// The vacancy leaves the set as soon as it's claimed, its new vacancy
+// (the origin) only joins once the move is applied.
+void InhabitantSystem::UpdateGlobal()
+{
+    InhabitantsSettings& iSettings = settings;
+
+    ForEachCell([&](V2<i32> position)
+    {
+        InhabitantCell cell = CellAt(position.x, position.y);
+        if (cell.IsEmpty())
+        {
+            return;
+        }
+
+        ArchetypeIndex type = inhabitants.archetype[cell.Id()];
+        f32 score = CalcCellScore(type, position, position);
+
+        if (score >= iSettings.gHappinessThreshold)
+        {
+            return;
+        }
+
+        if (vacancies.Count() == 0)
+        {
+            // Still unhappy next turn even if nothing around changes
+            if (useActiveSet)
+            {
+                activeSet.Mark(CellIndex(position.x, position.y));
+            }
+            return;
+        }
+
+        u32 vacancy = vacancies.Sample(
+                        RandomAt(seed, turnCount,
+                                 CellIndex(position.x, position.y)));
+        vacancies.Remove(vacancy);
+
+        V2<i32> destination = CellPosition(vacancy);
+        assert(CellAt(destination.x, destination.y).IsEmpty());
+
+        movingInhabitants.push_back({.id = cell.Id(),
+                                     .destination = destination,
+                                     .origin = position});
+
+        SetReservationAt(destination.x, destination.y, true);
+    });
+}
+
+
+// Like UpdateGlobal, but the vacancy is the best one for the inhabitant's
+// archetype and it has to beat staying home
+void InhabitantSystem::UpdateBestVacancy()
+{
+    InhabitantsSettings& iSettings = settings;
+
+    ForEachCell([&](V2<i32> position)
+    {
+        InhabitantCell cell = CellAt(position.x, position.y);
+        if (cell.IsEmpty())
+        {
+            return;
+        }
+
+        ArchetypeIndex type = inhabitants.archetype[cell.Id()];
+        f32 score = CalcCellScore(type, position, position);
+
+        if (score >= iSettings.gHappinessThreshold)
+        {
+            return;
+        }
+
+        RandomStream random = RandomStream::Create(seed, turnCount,
+                                        CellIndex(position.x, position.y));
+        u32 vacancy = FindBestVacancy(type, position, &random);
+        V2<i32> destination = CellPosition(vacancy);
+
+        if (vacancy == InvalidSlot
+            || CalcCellScore(type, destination, position) <= score)
+        {
+            // A better vacancy may open up anywhere, not just around here
+            if (useActiveSet)
+            {
+                activeSet.Mark(CellIndex(position.x, position.y));
+            }
+            return;
+        }
+
+        vacancyIndex.Remove(vacancy);
+
+        movingInhabitants.push_back({.id = cell.Id(),
+                                     .destination = destination,
+                                     .origin = position});
+
+        SetReservationAt(destination.x, destination.y, true);
+    });
+}
+
+
+u32 InhabitantSystem::FindBestVacancy(ArchetypeIndex archetype,
+                                      V2<i32> origin,
+                                      RandomStream* random)
+{
+    // Vacancies next to origin are indexed with the inhabitant counted as
+    // their neighbour, it sees one less than their bucket says
+    u32 near[gNeighbourCount];
+    i32 nearNet[gNeighbourCount];
+    i32 nearCount = 0;
+
+    for (V2<i32> offset : gNeighbourOffsets)
+    {
+        V2<i32> p = { origin.x + offset.x, origin.y + offset.y };
+        if (p.x < 0 || p.x >= (i32)dimensions.x
+            || p.y < 0 || p.y >= (i32)dimensions.y)
+        {
+            continue;
+        }
+
+        u32 index = CellIndex(p.x, p.y);
+        if (vacancyIndex.Contains(index))
+        {
+            near[nearCount] = index;
+            nearNet[nearCount] = vacancyIndex.NetOf(index, archetype) - 1;
+            nearCount++;
+        }
+    }
+
+    // Best bucket holding a vacancy that isn't next to origin
+    i32 farNet = i32Min;
+    size_t farCount = 0;
+
+    for (i32 net = vacancyIndex.BestNet(archetype);
+         net != i32Min;
+         net = vacancyIndex.BestNet(archetype, net - 1))
+    {
+        size_t count = vacancyIndex.Bucket(archetype, net).size();
+        for (i32 i = 0; i < nearCount; i++)
+        {
+            count -= (nearNet[i] + 1 == net) ? 1 : 0;
+        }
+
+        if (count > 0)
+        {
+            farNet = net;
+            farCount = count;
+            break;
+        }
+    }
+
+    i32 bestNet = farNet;
+    for (i32 i = 0; i < nearCount; i++)
+    {
+        bestNet = std::max(bestNet, nearNet[i]);
+    }
+
+    if (bestNet == i32Min)
+    {
+        return InvalidSlot;
+    }
+
+    u32 nearTies[gNeighbourCount];
+    u32 nearTieCount = 0;
+    for (i32 i = 0; i < nearCount; i++)
+    {
+        if (nearNet[i] == bestNet)
+        {
+            nearTies[nearTieCount++] = near[i];
+        }
+    }
+
+    size_t farTies = (farNet == bestNet) ? farCount : 0;
+
+    u32 pick = random->Next() % (farTies + nearTieCount);
+    if (pick < nearTieCount)
+    {
+        return nearTies[pick];
+    }
+
+    // Uniform over the far ones, at most gNeighbourCount members of the
+    // bucket are near and get rejected
+    std::vector<u32>& bucket = vacancyIndex.Bucket(archetype, bestNet);
+    while (true)
+    {
+        u32 candidate = bucket[random->Next() % bucket.size()];
+        if (!IsAdjacent(CellPosition(candidate), origin))
+        {
+            return candidate;
+        }
+    }
+}
+
+
+void InhabitantSystem::ParallelFor(size_t count,
+                const std::function<void(size_t index, u32 slot)>& fn)
+{
+    if (pool && (!Paged() || cells.pager->shared))
+    {
+        pool->ParallelFor(count, fn);
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        fn(i, 0);
+    }
+}
+
+void InhabitantSystem::ParallelForRows(size_t itemRows,
+                const std::function<void(size_t item, u32 slot)>& fn)
+{
+    assert(gChunkSize % itemRows == 0);
+
+    size_t count = (dimensions.y + itemRows - 1) / itemRows;
+    if (!Paged() || !pool)
+    {
+        ParallelFor(count, fn);
+        return;
+    }
+
+    // As many chunk rows as every grid keeps, less one either side. The
+    // capacity is three chunk rows at least, unless it is the whole grid
+    size_t chunkRows = cells.chunkRows;
+    size_t keptRows = cells.pager->capacity / cells.chunksPerRow;
+    size_t bandRows = keptRows >= chunkRows ? chunkRows : keptRows - 2;
+
+    size_t itemsPerChunkRow = gChunkSize / itemRows;
+
+    for (size_t first = 0; first < chunkRows; first += bandRows)
+    {
+        size_t end = std::min(chunkRows, first + bandRows);
+
+        ShareChunkRows(first > 0 ? first - 1 : 0,
+                       std::min(chunkRows, end + 1));
+
+        size_t firstItem = first * itemsPerChunkRow;
+        size_t endItem = std::min(count, end * itemsPerChunkRow);
+        ParallelFor(endItem - firstItem, [&](size_t i, u32 slot)
+        {
+            fn(firstItem + i, slot);
+        });
+
+        EndShare();
+    }
+}
+
+void InhabitantSystem::ShareChunkRows(size_t first, size_t end)
+{
+    size_t chunksPerRow = cells.chunksPerRow;
+
+    cells.pager->Share(first * chunksPerRow, end * chunksPerRow);
+    cellArchetypes.pager->Share(first * chunksPerRow, end * chunksPerRow);
+    neighbourCounts.pager->Share(first, end);
+}
+
+void InhabitantSystem::EndShare()
+{
+    cells.pager->EndShare();
+    cellArchetypes.pager->EndShare();
+    neighbourCounts.pager->EndShare();
+}
+
+void InhabitantSystem::Populate()
+{
+    InhabitantsSettings& iSettings = settings;
+
+    size_t cellCount = CellCount();
+    size_t count = iSettings.size * iSettings.size * iSettings.gMaxInhabitants;
+    size_t archetypeCount = iSettings.archetypes.size();
+
+    assert(count <= cellCount);
+    assert(count <= gMaxCellInhabitants);
+    assert(inhabitants.Count() == 0);
+
+    // Selection sampling (Knuth's algorithm S): every cell is taken with
+    // probability still needed / cells left, which picks exactly count
+    // cells uniformly in one sequential pass. That pass only notes what
+    // is still needed where each row starts, ids follow row major order
+    i32 rows = dimensions.y;
+    std::vector<size_t> rowFirstId(rows, 0);
+
+    RandomStream random = RandomStream::Create(seed, gPopulateStream, 0);
+    size_t needed = count;
+
+    for (size_t index = 0; index < cellCount; index++)
+    {
+        if (index % dimensions.x == 0)
+        {
+            rowFirstId[index / dimensions.x] = count - needed;
+        }
+
+        u64 left = cellCount - index;
+        if ((u64)random.Next() * left < (u64)needed << 32)
+        {
+            needed--;
+        }
+    }
+    assert(needed == 0);
+
+    inhabitants.Resize(count);
+    // Rows draw the same numbers again to find their cells, which keeps
+    // a byte per cell out of memory. Archetypes come from each row's own
+    // stream, so the result doesn't depend on which thread fills which
+    // row. A thread takes whole chunk rows, chunks get allocated by the
+    // one thread writing them
+    ParallelFor(cells.chunkRows, [&](size_t chunkRow, u32)
+    {
+        size_t yEnd = std::min<size_t>(rows, (chunkRow + 1) * gChunkSize);
+        for (size_t y = chunkRow * gChunkSize; y < yEnd; y++)
+        {
+            InhabitantID id = rowFirstId[y];
+            RandomStream rowRandom = RandomStream::Create(seed,
+                                                          gArchetypeStream,
+                                                          y);
+
+            size_t rowStart = y * dimensions.x;
+            RandomStream cellRandom = RandomStream::Create(seed,
+                                                           gPopulateStream,
+                                                           0);
+            cellRandom.Seek(rowStart);
+            size_t rowNeeded = count - id;
+
+            for (size_t x = 0; x < dimensions.x; x++)
+            {
+                u64 left = cellCount - (rowStart + x);
+                if ((u64)cellRandom.Next() * left >= (u64)rowNeeded << 32)
+                {
+                    continue;
+                }
+                rowNeeded--;
+
+                ArchetypeIndex type = rowRandom.Next() % archetypeCount;
+                V2<i32> position = { (i32)x, (i32)y };
+
+                inhabitants.Set(id, type, position);
+                SetCellAt(x, y, InhabitantCell::Create(id));
+                id++;
+            }
+        }
+    });
+
+    RebuildFromCells();
+}
+
+void InhabitantSystem::RebuildFromCells()
+{
+    i32 rows = dimensions.y;
+    std::vector<u64> rowHash(rows, 0);
+
+    // Runs fn(y) on every row, a thread taking whole chunk rows: bit
+    // plane rows only hold their own cells, chunked grids are written by
+    // the one thread their chunk row went to
+    auto forEachRow = [&](auto&& fn)
+    {
+        ParallelFor(cells.chunkRows, [&](size_t chunkRow, u32)
+        {
+            size_t yEnd = std::min<size_t>(rows, (chunkRow + 1) * gChunkSize);
+            for (size_t y = chunkRow * gChunkSize; y < yEnd; y++)
+            {
+                fn(y);
+            }
+        });
+    };
+
+    forEachRow([&](size_t y)
+    {
+        for (size_t x = 0; x < dimensions.x; x++)
+        {
+            u32 index = CellIndex(x, y);
+            InhabitantID id = CellAt(x, y).Id();
+            if (id < 0)
+            {
+                continue;
+            }
+
+            ArchetypeIndex type = inhabitants.ArchetypeOf(id);
+            V2<i32> position = { (i32)x, (i32)y };
+
+            if (Paged())
+            {
+                cellArchetypes.Set(x, y, type);
+            }
+            else
+            {
+                inhabitants.animation[id] = { .position = { (f32)x,
+                                                            (f32)y } };
+            }
+
+            if (neighbourBackend == ENeighbourBackend::BitPlanes)
+            {
+                bitPlanes.Set(position, type);
+            }
+
+            rowHash[y] ^= StateKey(index, type);
+        }
+    });
+
+    stateHash = 0;
+    for (u64 hash : rowHash)
+    {
+        stateHash ^= hash;
+    }
+
+    // Counts are gathered from the neighbours, every row only writes
+    // its own cells
+    if (neighbourBackend == ENeighbourBackend::CountGrid)
+    {
+        auto archetypeAt = [this](i32 x, i32 y)
+        {
+            InhabitantID id = CellAt(x, y).Id();
+            return id < 0 ? -1 : (i32)ArchetypeAt({ x, y }, id);
+        };
+
+        ParallelForRows(1, [&](size_t y, u32)
+        {
+            neighbourCounts.RecountRow(y, archetypeAt);
+        });
+    }
+
+#ifndef NDEBUG
+    // Sanity check, once everyone is in place
+    size_t found = 0;
+    for (int y = 0; y < (i32)dimensions.y; y++)
+    for (int x = 0; x < (i32)dimensions.x; x++)
+    {
+        InhabitantCell cell = CellAt(x, y);
+        if (cell.IsEmpty())
+        {
+            continue;
+        }
+
+        V2<i32> iPos = inhabitants.PositionOf(cell.Id());
+
+        assert (x == iPos.x);
+        assert (y == iPos.y);
+
+        found++;
+    }
+    assert (found == inhabitants.Count());
+#endif
+
+    if (trackVacancies)
+    {
+        for (size_t i = 0; i < CellCount(); i++)
+        {
+            V2<i32> position = CellPosition(i);
+            if (CellAt(position.x, position.y).IsEmpty())
+            {
+                vacancies.Insert(i);
+            }
+        }
+    }
+
+    if (indexVacancies)
+    {
+        for (size_t i = 0; i < CellCount(); i++)
+        {
+            V2<i32> position = CellPosition(i);
+            if (CellAt(position.x, position.y).IsEmpty())
+            {
+                IndexVacancy(position);
+            }
+        }
+    }
+
+    if (trackMetrics)
+    {
+        RecountMetrics();
+    }
+
+    // Everyone gets evaluated on the first turn
+    if (useActiveSet)
+    {
+        activeSet.MarkAll();
+    }
+}
+
+void InhabitantSystem::RecountMetrics()
+{
+    size_t archetypeCount = metrics.archetypeCount;
+
+    // Block rows own their blocks, pairs and happy counts go per slot
+    std::vector<std::vector<u64>> slotPairs(settings.threadCount,
+                            std::vector<u64>(archetypeCount * archetypeCount));
+    std::vector<u64> slotHappy(settings.threadCount, 0);
+
+    ParallelForRows(gMetricsBlockSize, [&](size_t blockRow, u32 slot)
+    {
+        std::vector<u64>& pairs = slotPairs[slot];
+
+        size_t yEnd = std::min(dimensions.y,
+                               (blockRow + 1) * gMetricsBlockSize);
+        for (size_t y = blockRow * gMetricsBlockSize; y < yEnd; y++)
+        for (size_t x = 0; x < dimensions.x; x++)
+        {
+            InhabitantID id = CellAt(x, y).Id();
+            if (id < 0)
             {
                 continue;
             }
 
-            Inhabitant in = inhabitants[cell.inhabitantId];
-            V2<i32> oPos = {x, y};
-            V2<i32> iPos = {(i32)in.position.x, (i32)in.position.z};
+            V2<i32> position = { (i32)x, (i32)y };
+            ArchetypeIndex type = ArchetypeAt(position, id);
+
+            size_t block = metrics.BlockOf(position);
+            metrics.blockCounts[block * archetypeCount + type]++;
+            metrics.blockTotals[block]++;
+
+            // Every pair once, from its left or upper end
+            if (x + 1 < dimensions.x && !CellAt(x + 1, y).IsEmpty())
+            {
+                ArchetypeIndex other = ArchetypeAt({ (i32)x + 1, (i32)y },
+                                                   CellAt(x + 1, y).Id());
+                pairs[type * archetypeCount + other]++;
+                pairs[other * archetypeCount + type]++;
+            }
+            if (y + 1 < dimensions.y && !CellAt(x, y + 1).IsEmpty())
+            {
+                ArchetypeIndex other = ArchetypeAt({ (i32)x, (i32)y + 1 },
+                                                   CellAt(x, y + 1).Id());
+                pairs[type * archetypeCount + other]++;
+                pairs[other * archetypeCount + type]++;
+            }
+
+            slotHappy[slot] += IsHappy(id, position) ? 1 : 0;
+        }
+    });
+
+    for (size_t block = 0; block < metrics.blockTotals.size(); block++)
+    for (size_t a = 0; a < archetypeCount; a++)
+    {
+        metrics.archetypeTotals[a] +=
+                            metrics.blockCounts[block * archetypeCount + a];
+    }
+    metrics.total = inhabitants.Count();
+
+    metrics.happy = 0;
+    for (u64 happy : slotHappy)
+    {
+        metrics.happy += happy;
+    }
+
+    for (std::vector<u64>& pairs : slotPairs)
+    for (size_t a = 0; a < archetypeCount; a++)
+    for (size_t b = 0; b < archetypeCount; b++)
+    {
+        u64 count = pairs[a * archetypeCount + b];
+        metrics.pairs[a * archetypeCount + b] += count;
+        metrics.pairTotals[a] += count;
+        if (a != b)
+        {
+            // Both orders are counted, the boundary has each pair once
+            metrics.mixedPairs += count;
+        }
+    }
+    metrics.mixedPairs /= 2;
+
+    metrics.RecountDissimilarity();
+}
 
-            assert (oPos.x == iPos.x);
-            assert (oPos.y == iPos.y);
+void InhabitantSystem::CountMetricPairs(V2<i32> position,
+                                        ArchetypeIndex type,
+                                        i64 delta)
+{
+    for (V2<i32> offset : gNeighbourOffsets)
+    {
+        V2<i32> p = { position.x + offset.x, position.y + offset.y };
+        if (p.x < 0 || p.x >= (i32)dimensions.x
+            || p.y < 0 || p.y >= (i32)dimensions.y)
+        {
+            continue;
+        }
 
+        InhabitantID id = CellAt(p.x, p.y).Id();
+        if (id >= 0)
+        {
+            metrics.AddPair(type, ArchetypeAt(p, id), delta);
         }
+    }
+}
 
+u64 InhabitantSystem::CountHappyAround(V2<i32> origin, V2<i32> destination)
+{
+    // Both cells and their neighbours, the two neighbourhoods overlap
+    // when the move is to an adjacent cell
+    V2<i32> around[2 * (gNeighbourCount + 1)];
+    size_t cellCount = 0;
+
+    for (V2<i32> centre : { origin, destination })
+    {
+        around[cellCount++] = centre;
+        for (V2<i32> offset : gNeighbourOffsets)
+        {
+            around[cellCount++] = { centre.x + offset.x, centre.y + offset.y };
+        }
+    }
+
+    u64 happy = 0;
+    for (size_t i = 0; i < cellCount; i++)
+    {
+        V2<i32> p = around[i];
+        if (p.x < 0 || p.x >= (i32)dimensions.x
+            || p.y < 0 || p.y >= (i32)dimensions.y)
+        {
+            continue;
+        }
+
+        bool seen = false;
+        for (size_t j = 0; j < i && !seen; j++)
+        {
+            seen = around[j].x == p.x && around[j].y == p.y;
+        }
+
+        InhabitantID id = CellAt(p.x, p.y).Id();
+        if (!seen && id >= 0 && IsHappy(id, p))
+        {
+            happy++;
+        }
     }
+    return happy;
 }
@@ -3,26 +3,31 @@
 
 #include <vector>
 #include <cstdint>
+#include <memory>
+#include <string>
+#include <algorithm>
+#include <cassert>
 
-#include "raylib.h"
 #include "gametypes.h"
-#include "aabb.h"
 #include "math.h"
-#include "resources.h"
+#include "inhabitantstore.h"
+#include "neighbourcounts.h"
+#include "bitplanes.h"
+#include "activeset.h"
+#include "cellset.h"
+#include "metrics.h"
+#include "chunkedgrid.h"
+#include "vacancyindex.h"
+#include "threadpool.h"
+#include "rng.h"
+#include "convergence.h"
 
 
-typedef i64 InhabitantID;
-constexpr InhabitantID InvalidId = -1;
+struct MoveRecorder;
 
 struct InhabitantArchetype
 {
-    Color color;
-};
-
-struct Inhabitant
-{
-    InhabitantArchetype type;
-    Vector3 position;
+    RGBA8 color;
 };
 
 struct MovingInhabitant
@@ -33,14 +38,101 @@ struct MovingInhabitant
 };
 
 
+// Order of the cells inside a chunk, see layoutbench for how the
+// layouts compare
+using CellLayout = RowMajorLayout;
+
+// A cell packs its inhabitant's id and a reservation stamp in 32 bits
+constexpr u32 gCellIdBits = 28;
+constexpr u32 gCellIdMask = (1u << gCellIdBits) - 1;
+
+// Id field of an empty cell, every id is below it
+constexpr u32 gCellNoInhabitant = gCellIdMask;
+constexpr u64 gMaxCellInhabitants = gCellNoInhabitant;
+
+// Stamps a turn can reserve with, 0 is never current
+constexpr u32 gReservationStamps = 1u << (32 - gCellIdBits);
+
 struct InhabitantCell
 {
+    u32 bits = gCellNoInhabitant;
+
+    static inline
+    InhabitantCell Create(InhabitantID id)
+    {
+        assert(id >= 0 && (u64)id < gMaxCellInhabitants);
+        return { .bits = (u32)id };
+    }
+
+    inline
+    bool IsEmpty() const
+    {
+        return (bits & gCellIdMask) == gCellNoInhabitant;
+    }
+
+    // InvalidId when empty
+    inline
+    InhabitantID Id() const
+    {
+        return IsEmpty() ? InvalidId : (InhabitantID)(bits & gCellIdMask);
+    }
+
+    inline
+    u32 Stamp() const
+    {
+        return bits >> gCellIdBits;
+    }
+
+    inline
+    void SetStamp(u32 stamp)
+    {
+        bits = (bits & gCellIdMask) | (stamp << gCellIdBits);
+    }
+};
+
+enum class EUpdateMode
+{
+    // Serial row major sweep, earlier cells reserve first
+    Sweep = 0,
+
+    // Grid split into tiles, tiles updated in four phases by tile
+    // coordinate parity, tiles of one phase in parallel.
+    // See InhabitantSystem::UpdateCheckerboard for the guarantees
+    Checkerboard,
+
+    // Everyone proposes a move against the same grid in parallel, then
+    // contested destinations go to the highest random priority. No
+    // iteration order bias, see InhabitantSystem::UpdateSynchronous
+    Synchronous,
+
+    // Inhabitants visited one at a time in a fresh random order every
+    // turn, each move applied before the next one looks. Everyone is
+    // visited, the active set doesn't apply. See
+    // InhabitantSystem::UpdateRandomSequential
+    RandomSequential,
+};
+
+enum class ENeighbourBackend
+{
+    // Per cell count of every archetype around it, a byte per archetype
+    CountGrid = 0,
 
-    InhabitantID inhabitantId = InvalidId;
-    bool reserved = false;
+    // One bit plane per archetype plus occupancy, neighbours counted
+    // with shifts and popcounts. At most gMaxBitPlaneArchetypes archetypes
+    BitPlanes,
+};
+
+enum class EMovementMode
+{
+    // Step to the best of the four adjacent cells, if it beats staying
+    Adjacent = 0,
 
-    inline bool IsEmpty() { return inhabitantId < 0
-                                    && !reserved;}
+    // Unhappy inhabitants jump to a random vacancy anywhere, serial only
+    Global,
+
+    // Unhappy inhabitants jump to the best vacancy anywhere for their
+    // archetype, if it beats staying. Serial only
+    BestVacancy,
 };
 
 struct InhabitantsSettings
@@ -49,65 +141,396 @@ struct InhabitantsSettings
     f32 gIntoleranceFactor = 0.1f;
     size_t size = 64;
 
+    // Global and best vacancy movement: inhabitants scoring below this at
+    // home are unhappy
+    f32 gHappinessThreshold = 0.0f;
+
+    EMovementMode movementMode = EMovementMode::Adjacent;
+    EUpdateMode updateMode = EUpdateMode::Sweep;
+    ENeighbourBackend neighbourBackend = ENeighbourBackend::CountGrid;
+
+    // Checkerboard tile side, has to be at least 2
+    size_t tileSize = 64;
+
+    ConvergenceSettings convergence = {};
+
+    // Threads used by parallel update modes, 1 runs everything inline
+    u32 threadCount = 1;
+
+    // Only evaluate inhabitants near last turn's moves, gives the same
+    // result as evaluating everyone
+    bool useActiveSet = true;
+
+    // Keep SegregationMetrics up to date, costs a little on every move
+    bool trackMetrics = false;
+
+    // Keep everything there is per cell or per inhabitant in files at
+    // this path, with only pagedChunks chunks of each in memory (see
+    // PagedCapacity). Empty keeps it all in memory. A paged system uses
+    // threads for a band of chunk rows at a time, see ParallelForRows.
+    // The sweep and anything going through the inhabitant columns run on
+    // one thread.
+    //
+    // Paged are the cells, their neighbour counts, a copy of every cell's
+    // archetype, the terrain and the inhabitant columns. What stays in
+    // memory is per chunk or per row, and the metric blocks at a few
+    // bytes per 256 cells. Only settings CanPage allows can be paged, and
+    // a paged system keeps no active set, whose marks grow with the world
+    std::string pageFile = {};
+    size_t pagedChunks = 0;
+
     std::vector<InhabitantArchetype> archetypes = {};
+
+    // Paging needs every pass to go over the grid row by row. Global and
+    // best vacancy movement jump anywhere, the synchronous and random
+    // sequential modes keep state per cell or per inhabitant of their
+    // own, and the bit planes aren't chunked
+    inline
+    bool CanPage() const
+    {
+        return movementMode == EMovementMode::Adjacent
+            && (updateMode == EUpdateMode::Sweep
+                || updateMode == EUpdateMode::Checkerboard)
+            && neighbourBackend == ENeighbourBackend::CountGrid;
+    }
+
+    // Chunks every paged grid keeps in memory. A pass over the grid looks
+    // at three chunk rows around any one cell, with those in memory each
+    // chunk comes in once per pass. A checkerboard turn may come back to
+    // a chunk four tile rows further on, it keeps those and one more
+    inline
+    size_t PagedCapacity() const
+    {
+        size_t chunksPerRow = (size + gChunkSize - 1) >> gChunkShift;
+
+        size_t chunkRows = 3;
+        if (updateMode == EUpdateMode::Checkerboard)
+        {
+            chunkRows = std::max(chunkRows,
+                                 (4 * tileSize + 2) / gChunkSize + 3);
+        }
+        return std::max(pagedChunks, chunkRows * chunksPerRow);
+    }
+
+    // Replaces the archetypes with count generated ones. Colors are only
+    // for drawing, but keep the archetypes distinct
+    inline
+    void SetArchetypeCount(size_t count)
+    {
+        archetypes.resize(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            archetypes[i].color = { (u8)i, (u8)(i >> 8), 0, 255 };
+        }
+    }
 };
 
 struct InhabitantSystem
 {
-    static constexpr f32 gMaxInhabitants = 0.5f;
-
-    static constexpr f32 gIntoleranceFactor = 0.1f;
+    // Copied at creation, every system runs on its own settings
+    InhabitantsSettings settings = {};
 
     V2<size_t> dimensions = {};
-    std::vector<InhabitantCell> cells = {};
-    std::vector<bool> reservations = {};
 
-    std::vector<Inhabitant> inhabitants = {};
+    // Chunks without inhabitants are never allocated. Cell indices (RNG
+    // keys, vacancies, the state hash) stay row major, only the storage
+    // is chunked
+    ChunkedGrid<InhabitantCell, CellLayout> cells = {};
+
+    // A cell is reserved this turn when its stamp is this one, so nothing
+    // has to be cleared between turns. Starts at the last stamp so the
+    // first turn clears whatever stamps the cells came with
+    u32 reservationStamp = gReservationStamps - 1;
+
+    InhabitantStore inhabitants = {};
+
+    ENeighbourBackend neighbourBackend = ENeighbourBackend::CountGrid;
+    bool useActiveSet = true;
+    bool trackVacancies = false;
+    bool indexVacancies = false;
+    bool trackMetrics = false;
+
+    // Only the one matching neighbourBackend is allocated
+    NeighbourCountGrid neighbourCounts = {};
+    BitPlaneGrid bitPlanes = {};
+
+    // Paged only, the archetype of every cell's inhabitant. Passes over
+    // the cells read it instead of the inhabitant's column, which would
+    // page in chunks of ids on the side. Stale in empty cells
+    ChunkedGrid<ArchetypeIndex> cellArchetypes = {};
+
+    // Bit plane backend scratch, one per ParallelFor slot
+    std::vector<BitPlaneRowScores> rowScores = {};
 
 
     f32 movementProgress = 0;
     std::vector<MovingInhabitant> movingInhabitants = {};
 
+    // Checkerboard moves per tile, or synchronous proposals per slice,
+    // merged in order once all are in
+    std::vector<std::vector<MovingInhabitant>> tileMoves = {};
+
+    // Synchronous only, per cell the gNeighbourOffsets index + 1 of the
+    // move proposed from it this turn, 0 for none
+    std::vector<u8> proposedDirections = {};
+
+    // Random sequential only, this turn's visiting order: a random key in
+    // the high bits over every inhabitant's id. And per slice of ids and
+    // bucket a count, then a write offset, see ShuffleVisitOrder
+    std::vector<u64> visitOrder = {};
+    std::vector<u32> bucketCounts = {};
+
+    // Marked by ApplyMove, taken into activeCells when a turn starts
+    ActiveSet activeSet = {};
+    std::vector<u32> activeCells = {};
+
+    // Checkerboard activeCells split per tile
+    std::vector<std::vector<u32>> tileActive = {};
+
+    // Empty and unclaimed cells, only with trackVacancies
+    CellSet vacancies = {};
+
+    // Empty and unclaimed cells by score, only with indexVacancies
+    VacancyIndex vacancyIndex = {};
+
+    std::shared_ptr<ThreadPool> pool = {};
+
+    // Every random number is RandomAt(seed, turn, cell) or a stream of it
+    u64 seed = 0;
     u64 turnCount = 0;
     bool turnInProgress = false;
 
+    // The turn's moves are in the cells already, the animation only
+    // catches up with them
+    bool movesApplied = false;
+
+    // XOR of StateKey over every inhabitant, kept up to date by moves
+    u64 stateHash = 0;
+
+    ConvergenceTracker convergence = {};
+
+    // Kept up to date only with trackMetrics, otherwise empty until
+    // created and filled in by RecountMetrics
+    SegregationMetrics metrics = {};
+
+    // Gets every finished turn's moves when set
+    std::shared_ptr<MoveRecorder> recorder = {};
+
     // Functions
     static
-    InhabitantSystem Create();
+    InhabitantSystem Create(const InhabitantsSettings& settings, u64 seed);
 
     void Populate();
-    void Draw(AABB<i32> box, Resources* resources);
+
+    // Everything derived from cells and the inhabitant columns (neighbour
+    // backend, state hash, vacancies, active set) filled in from them.
+    // For a freshly created system whose cells were just set
+    void RebuildFromCells();
     void UpdateSchelling(int frameCount);
 
+    // Moves on to the next turn's stamp, clearing every stamp in the grid
+    // whenever they come round again
+    void NextReservationStamp();
+
+    void UpdateSweep();
+    void UpdateCheckerboard();
+    void UpdateSynchronous();
+    void UpdateRandomSequential();
+
+    // Fills visitOrder with a uniformly random permutation of the
+    // inhabitants, drawn from the turn's stream
+    void ShuffleVisitOrder();
+    void UpdateGlobal();
+    void UpdateBestVacancy();
+
+    // Best vacancy for an inhabitant of archetype standing at origin,
+    // ties broken uniformly. InvalidSlot when there are no vacancies
+    u32 FindBestVacancy(ArchetypeIndex archetype,
+                        V2<i32> origin,
+                        RandomStream* random);
+
+    // (Re)files an empty cell in vacancyIndex under its current scores
+    void IndexVacancy(V2<i32> position);
+
+    // Calls visit(position) for the active cells, or for every cell
+    // without an active set, in row major order
+    template<typename VisitFn>
+    void ForEachCell(VisitFn&& visit);
+
+    // Decides where the inhabitant at position goes this turn, if
+    // anywhere, reserves the destination and appends the move. Without
+    // reserve reservations are neither made nor looked at.
+    // net(archetype, position) returns NetScoreAt or an equal cached value.
+    template<typename NetFn>
+    void UpdateCell( V2<i32> position,
+                     NetFn&& net,
+                     std::vector<MovingInhabitant>* moves,
+                     bool reserve = true);
+
+    // Adjacent cells an inhabitant of currentType at position could step
+    // to: empty, unreserved unless reserve is false, and strictly better
+    // than staying. Only those sharing the best score go in bestDirs
+    // (gNeighbourOffsets indices), returns how many
+    template<typename NetFn>
+    i32 FindBetterNeighbours(V2<i32> position,
+                             ArchetypeIndex currentType,
+                             NetFn&& net,
+                             bool reserve,
+                             i32* bestDirs);
+
+    // FindBetterNeighbours for the inhabitant at position as the cells
+    // are now, reservations ignored
+    i32 BetterNeighbours(V2<i32> position, i32* directions);
+
+    // Whether BetterNeighbours would find any, stopping at the first
+    bool HasBetterNeighbour(V2<i32> position);
+
+    // Synchronous tie break, the inhabitant at cell wins a destination
+    // over the one at other
+    bool OutranksAt(u32 cell, u32 other);
+
+    // Runs fn(index, slot) for index in [0, count), on the pool if any.
+    // A paged system runs it inline unless its chunks are shared
+    void ParallelFor(size_t count,
+                     const std::function<void(size_t index, u32 slot)>& fn);
+
+    // ParallelFor over the grid's rows in items of itemRows rows, which
+    // divides gChunkSize. Items may read one row around their own. A
+    // paged system goes a band of chunk rows at a time, the band and a
+    // chunk row either side shared while the items in it run
+    void ParallelForRows(size_t itemRows,
+                const std::function<void(size_t item, u32 slot)>& fn);
+
+    // Shares chunk rows [first, end) of every paged grid the turns go
+    // through, see ChunkPager::Share
+    void ShareChunkRows(size_t first, size_t end);
+    void EndShare();
+
+    // Score an inhabitant standing at origin sees for a cell with the given
+    // net score, it is not its own neighbour
+    f32 ScoreFromNet(i32 net, V2<i32> position, V2<i32> origin);
+
+    // Score of position for an inhabitant of archetype currently standing
+    // at origin, the inhabitant is never counted as its own neighbour
     f32 
-    CalcCellScore ( Inhabitant* inhabitant,
-                         V2<i32> position);
-    f32 
-    CalcNeighbourScore ( Inhabitant* inhabitant,
-                         V2<i32> position);
+    CalcCellScore ( ArchetypeIndex archetype,
+                         V2<i32> position,
+                         V2<i32> origin);
 
+    // Same kind minus other kind neighbours of position for archetype,
+    // counting every inhabitant around it
+    inline
+    i32 NetScoreAt(ArchetypeIndex archetype, V2<i32> position)
+    {
+        if (neighbourBackend == ENeighbourBackend::BitPlanes)
+        {
+            return bitPlanes.NetAt(archetype, position.x, position.y);
+        }
+
+        return neighbourCounts.NetAt(position.x, position.y, archetype);
+    }
 
     bool UpdateCellMovement(f32 dt);
 
+    void ApplyMove(MovingInhabitant move);
+
     void StartNextTurn();
 
+    // Called once the moves of a turn have all been applied
+    void FinishTurn();
+
+    // Runs whole turns until the tracker calls the run converged or
+    // maxTurns more turns have gone by
+    ConvergenceResult RunUntilConverged(u64 maxTurns);
+
+    // Inhabitants scoring below gHappinessThreshold where they stand
+    u64 CountUnhappy();
+
+    inline
+    bool IsHappy(InhabitantID id, V2<i32> position)
+    {
+        return CalcCellScore(ArchetypeAt(position, id), position, position)
+                    >= settings.gHappinessThreshold;
+    }
+
+    // Fills metrics in from scratch
+    void RecountMetrics();
+
+    // Neighbour pairs the inhabitant of type at position is part of
+    void CountMetricPairs(V2<i32> position, ArchetypeIndex type, i64 delta);
+
+    // Happy inhabitants at and around both cells of a move
+    u64 CountHappyAround(V2<i32> origin, V2<i32> destination);
+
+    inline
+    u64 StateKey(u32 cell, ArchetypeIndex archetype)
+    {
+        return Mix64(((u64)cell << 8) | archetype);
+    }
+
     void Update(f32 dt);
 
     inline
-    InhabitantCell& CellAt(int x, int y)
+    u32 CellIndex(int x, int y)
+    {
+        return (y * dimensions.x) + x;
+    }
+
+    inline
+    V2<i32> CellPosition(size_t index)
+    {
+        return { (i32)(index % dimensions.x), (i32)(index / dimensions.x) };
+    }
+
+    inline
+    size_t CellCount()
+    {
+        return dimensions.x * dimensions.y;
+    }
+
+    // Whether the cells and everything else per cell or per inhabitant
+    // are paged, see InhabitantsSettings::pageFile
+    inline
+    bool Paged()
+    {
+        return (bool)cells.pager;
+    }
+
+    // Archetype of inhabitant id, which stands at position
+    inline
+    ArchetypeIndex ArchetypeAt(V2<i32> position, InhabitantID id)
+    {
+        if (Paged())
+        {
+            return cellArchetypes.Get(position.x, position.y);
+        }
+        return inhabitants.archetype[id];
+    }
+
+    inline
+    InhabitantCell CellAt(int x, int y)
+    {
+        return cells.Get(x, y);
+    }
+
+    // Allocates the cell's chunk, see ChunkedGrid on threads
+    inline
+    void SetCellAt(int x, int y, InhabitantCell cell)
     {
-        return cells[(y * dimensions.x) + x];
+        cells.Set(x, y, cell);
     }
 
     inline
     bool GetReservationAt(int x, int y)
     {
-        return reservations[(y * dimensions.x) + x];
+        return CellAt(x, y).Stamp() == reservationStamp;
     }
 
+    // Checkerboard tiles reserve from several threads, their cells are
+    // always in allocated chunks (see UpdateCheckerboard)
     inline
     void SetReservationAt(int x, int y, bool value)
     {
-        reservations[(y * dimensions.x) + x] = value;
+        cells.At(x, y).SetStamp(value ? reservationStamp : 0);
     }
 };
@@ -0,0 +1,32 @@
+#include "inhabitantrendering.h"
+
+#include "utils.h"
+
+void InhabitantDrawSystem::DrawInhabitants( InhabitantSystem* inhabitants,
+                                            AABB<i32> cullingBox,
+                                            Resources* r)
+{
+    Model m = r->models["InhabitantToken"];
+
+    InhabitantsSettings& iSettings = inhabitants->settings;
+    InhabitantStore& store = inhabitants->inhabitants;
+
+    for (int i = cullingBox.xMin; i < cullingBox.xMax; ++i)
+    for (int j = cullingBox.yMin; j < cullingBox.yMax; ++j)
+    {
+        InhabitantCell cell = inhabitants->CellAt(i,j);
+
+        if (cell.IsEmpty())
+        {
+            continue;
+        }
+
+        InhabitantID id = cell.Id();
+        V2<f32> position = store.animation[id].position;
+        RGBA8 color = iSettings.archetypes[store.archetype[id]].color;
+
+        Vector3 drawPos = {position.x,  0.1f, position.y};
+
+        DrawModel(m, drawPos, 1.0f, ToColor(color));
+    }
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "raylib.h"
+
+#include "aabb.h"
+#include "gametypes.h"
+#include "inhabitant.h"
+#include "resources.h"
+
+
+struct InhabitantDrawSystem
+{
+    void DrawInhabitants( InhabitantSystem* inhabitants,
+                          AABB<i32> cullingBox,
+                          Resources* resources);
+};
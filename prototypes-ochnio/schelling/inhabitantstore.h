@@ -0,0 +1,220 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cassert>
+#include <limits>
+
+#include "gametypes.h"
+#include "math.h"
+#include "chunkpager.h"
+
+
+typedef i64 InhabitantID;
+constexpr InhabitantID InvalidId = -1;
+
+// Index into InhabitantsSettings::archetypes
+typedef u8 ArchetypeIndex;
+constexpr size_t gMaxArchetypes = std::numeric_limits<ArchetypeIndex>::max() + 1;
+
+// Positions are stored as u16, so this is the largest world side
+constexpr size_t gMaxWorldSize = std::numeric_limits<u16>::max() + 1;
+
+// Only touched when drawing or animating
+struct InhabitantAnimation
+{
+    // Grid coordinates, fractional while the inhabitant is moving
+    V2<f32> position;
+};
+
+// Ids per chunk of a paged store
+constexpr size_t gPagedIdShift = 12;
+constexpr size_t gPagedIds = 1 << gPagedIdShift;
+
+// One chunk of a paged store's columns
+struct PagedColumns
+{
+    ArchetypeIndex* archetype;
+    u16* x;
+    u16* y;
+};
+
+// Structure of arrays, one entry per inhabitant in every column.
+// The schelling update only reads the archetype and position columns,
+// so a neighbour probe costs a single byte instead of a whole inhabitant.
+//
+// Once paged (see Page) the columns stay empty and live in a file
+// instead, gPagedIds consecutive ids a chunk. There is no animation
+// column then, nothing draws a paged system. Paged or not, the accessors
+// below work the same, only the vectors need the columns in memory.
+struct InhabitantStore
+{
+    std::vector<ArchetypeIndex> archetype = {};
+    std::vector<u16> x = {};
+    std::vector<u16> y = {};
+
+    // Cold
+    std::vector<InhabitantAnimation> animation = {};
+
+    std::shared_ptr<ChunkPager> pager = {};
+    size_t pagedCount = 0;
+
+    inline
+    size_t Count()
+    {
+        return pager ? pagedCount : archetype.size();
+    }
+
+    // Moves the columns into a file at path, keeping at most capacity
+    // chunks in memory from then on. The file has room for maxCount ids
+    bool Page(const char* path, size_t maxCount, size_t capacity)
+    {
+        assert(!pager && Count() <= maxCount);
+
+        // Each chunk holds its ids' archetypes, then x, then y
+        size_t chunkBytes = gPagedIds * (sizeof(ArchetypeIndex)
+                                         + 2 * sizeof(u16));
+        std::vector<u8> fillChunk(chunkBytes, 0);
+
+        pager = ChunkPager::Create(path, (maxCount + gPagedIds - 1)
+                                            >> gPagedIdShift,
+                                   chunkBytes, fillChunk.data(), capacity);
+        if (!pager)
+        {
+            return false;
+        }
+
+        pagedCount = archetype.size();
+        for (size_t id = 0; id < pagedCount; id++)
+        {
+            Set(id, archetype[id], { x[id], y[id] });
+        }
+
+        archetype = {};
+        x = {};
+        y = {};
+        animation = {};
+        return true;
+    }
+
+    // The columns of ids [chunk * gPagedIds, (chunk + 1) * gPagedIds),
+    // valid until the next access. Paged only
+    inline
+    PagedColumns ChunkColumns(size_t chunk, bool write)
+    {
+        u8* data = pager->Fetch(chunk, write);
+        return {
+            .archetype = data,
+            .x = (u16*)(data + gPagedIds * sizeof(ArchetypeIndex)),
+            .y = (u16*)(data + gPagedIds * (sizeof(ArchetypeIndex)
+                                            + sizeof(u16))),
+        };
+    }
+
+    inline
+    void Reserve(size_t count)
+    {
+        assert(!pager);
+
+        archetype.reserve(count);
+        x.reserve(count);
+        y.reserve(count);
+        animation.reserve(count);
+    }
+
+    inline
+    InhabitantID Add(ArchetypeIndex type, V2<i32> position)
+    {
+        assert(position.x >= 0 && position.x < (i32)gMaxWorldSize);
+        assert(position.y >= 0 && position.y < (i32)gMaxWorldSize);
+        assert(!pager);
+
+        InhabitantID id = archetype.size();
+
+        archetype.push_back(type);
+        x.push_back((u16)position.x);
+        y.push_back((u16)position.y);
+        animation.push_back({ .position = { (f32)position.x,
+                                            (f32)position.y } });
+        return id;
+    }
+
+    // Room for count inhabitants, filled in with Set in any order
+    inline
+    void Resize(size_t count)
+    {
+        if (pager)
+        {
+            assert(count <= pager->slotOf.size() << gPagedIdShift);
+            pagedCount = count;
+            return;
+        }
+
+        archetype.resize(count);
+        x.resize(count);
+        y.resize(count);
+        animation.resize(count);
+    }
+
+    inline
+    void Set(InhabitantID id, ArchetypeIndex type, V2<i32> position)
+    {
+        assert(position.x >= 0 && position.x < (i32)gMaxWorldSize);
+        assert(position.y >= 0 && position.y < (i32)gMaxWorldSize);
+
+        if (pager)
+        {
+            PagedColumns columns = ChunkColumns(id >> gPagedIdShift, true);
+            size_t i = id & (gPagedIds - 1);
+            columns.archetype[i] = type;
+            columns.x[i] = (u16)position.x;
+            columns.y[i] = (u16)position.y;
+            return;
+        }
+
+        archetype[id] = type;
+        x[id] = (u16)position.x;
+        y[id] = (u16)position.y;
+        animation[id] = { .position = { (f32)position.x,
+                                        (f32)position.y } };
+    }
+
+    inline
+    ArchetypeIndex ArchetypeOf(InhabitantID id)
+    {
+        if (pager)
+        {
+            return ChunkColumns(id >> gPagedIdShift, false)
+                        .archetype[id & (gPagedIds - 1)];
+        }
+        return archetype[id];
+    }
+
+    inline
+    V2<i32> PositionOf(InhabitantID id)
+    {
+        if (pager)
+        {
+            PagedColumns columns = ChunkColumns(id >> gPagedIdShift, false);
+            size_t i = id & (gPagedIds - 1);
+            return { columns.x[i], columns.y[i] };
+        }
+        return { x[id], y[id] };
+    }
+
+    inline
+    void SetPosition(InhabitantID id, V2<i32> position)
+    {
+        if (pager)
+        {
+            PagedColumns columns = ChunkColumns(id >> gPagedIdShift, true);
+            size_t i = id & (gPagedIds - 1);
+            columns.x[i] = (u16)position.x;
+            columns.y[i] = (u16)position.y;
+            return;
+        }
+
+        x[id] = (u16)position.x;
+        y[id] = (u16)position.y;
+    }
+};
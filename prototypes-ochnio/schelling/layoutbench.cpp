@@ -0,0 +1,365 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <vector>
+#include <string>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "gametypes.h"
+#include "chunkedgrid.h"
+#include "inhabitant.h"
+#include "rng.h"
+
+// Compares the cell layouts ChunkedGrid can use, and the flat row major
+// array the cells used to live in, on sweeps that read every cell's
+// neighbourhood: the simulation's four neighbours, or the whole
+// (2r + 1)^2 square around it. Cells are InhabitantCells, half of them
+// inhabited. Reports time per sweep and, where the kernel lets us count
+// them, cache misses per cell.
+//
+// Cells are visited row major like a turn does, or chunk by chunk
+// (row major inside every chunk) with --order chunks.
+
+struct BenchOptions
+{
+    size_t size = 4096;
+    std::vector<i32> radii = {};
+    u32 reps = 3;
+    bool chunkOrder = false;
+};
+
+static void PrintUsage(const char* program)
+{
+    printf("usage: %s [options]\n"
+           "  --size N          grid is N x N cells (default 4096)\n"
+           "  --radius R        also sweep (2R + 1)^2 squares, repeatable\n"
+           "  --reps N          sweeps per measurement, best is kept\n"
+           "  --order O         rows | chunks\n",
+           program);
+}
+
+// Row major cells in one array, what ChunkedGrid replaced
+struct FlatGrid
+{
+    static constexpr const char* name = "flat";
+
+    V2<size_t> dimensions = {};
+    std::vector<InhabitantCell> cells = {};
+
+    inline
+    InhabitantCell Get(int x, int y) const
+    {
+        return cells[(y * dimensions.x) + x];
+    }
+
+    inline
+    void Set(int x, int y, InhabitantCell cell)
+    {
+        cells[(y * dimensions.x) + x] = cell;
+    }
+};
+
+// A hardware counter of this process, invalid where perf isn't allowed
+struct PerfCounter
+{
+    int fd = -1;
+
+    static
+    PerfCounter Open(u32 type, u64 config)
+    {
+        perf_event_attr attr = {};
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        return { .fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0) };
+    }
+
+    void Start()
+    {
+        if (fd >= 0)
+        {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    // -1 without a counter
+    i64 Stop()
+    {
+        if (fd < 0)
+        {
+            return -1;
+        }
+
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+        i64 count = 0;
+        return read(fd, &count, sizeof(count)) == sizeof(count) ? count : -1;
+    }
+};
+
+struct BenchResult
+{
+    f64 seconds = 0.0;
+    i64 l1Misses = -1;
+    i64 llcMisses = -1;
+
+    // Keeps the compiler from dropping the sweep
+    u64 checksum = 0;
+};
+
+// Inhabited cells around every cell at least radius away from the edges.
+// radius 0 is the four neighbour cross
+template<typename Grid>
+static u64 Sweep(const Grid& grid, i32 radius, bool chunkOrder)
+{
+    i32 size = (i32)grid.dimensions.x;
+    i32 margin = radius > 0 ? radius : 1;
+    u64 occupied = 0;
+
+    auto visit = [&](i32 x, i32 y)
+    {
+        if (x < margin || y < margin
+            || x >= size - margin || y >= size - margin)
+        {
+            return;
+        }
+
+        if (radius == 0)
+        {
+            occupied += !grid.Get(x, y + 1).IsEmpty();
+            occupied += !grid.Get(x, y - 1).IsEmpty();
+            occupied += !grid.Get(x + 1, y).IsEmpty();
+            occupied += !grid.Get(x - 1, y).IsEmpty();
+            return;
+        }
+
+        for (i32 dy = -radius; dy <= radius; dy++)
+        for (i32 dx = -radius; dx <= radius; dx++)
+        {
+            occupied += !grid.Get(x + dx, y + dy).IsEmpty();
+        }
+    };
+
+    if (!chunkOrder)
+    {
+        for (i32 y = 0; y < size; y++)
+        for (i32 x = 0; x < size; x++)
+        {
+            visit(x, y);
+        }
+        return occupied;
+    }
+
+    for (i32 y0 = 0; y0 < size; y0 += gChunkSize)
+    for (i32 x0 = 0; x0 < size; x0 += gChunkSize)
+    {
+        i32 y1 = std::min<i32>(size, y0 + gChunkSize);
+        i32 x1 = std::min<i32>(size, x0 + gChunkSize);
+
+        for (i32 y = y0; y < y1; y++)
+        for (i32 x = x0; x < x1; x++)
+        {
+            visit(x, y);
+        }
+    }
+    return occupied;
+}
+
+template<typename Grid>
+static BenchResult Measure(const Grid& grid,
+                           i32 radius,
+                           const BenchOptions& opts)
+{
+    PerfCounter l1 = PerfCounter::Open(PERF_TYPE_HW_CACHE,
+                          PERF_COUNT_HW_CACHE_L1D
+                        | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    PerfCounter llc = PerfCounter::Open(PERF_TYPE_HARDWARE,
+                                        PERF_COUNT_HW_CACHE_MISSES);
+
+    BenchResult best = {};
+
+    for (u32 rep = 0; rep < opts.reps; rep++)
+    {
+        l1.Start();
+        llc.Start();
+        auto start = std::chrono::steady_clock::now();
+
+        u64 checksum = Sweep(grid, radius, opts.chunkOrder);
+
+        f64 seconds = std::chrono::duration<f64>(
+                        std::chrono::steady_clock::now() - start).count();
+        i64 l1Misses = l1.Stop();
+        i64 llcMisses = llc.Stop();
+
+        if (rep == 0 || seconds < best.seconds)
+        {
+            best = {
+                .seconds = seconds,
+                .l1Misses = l1Misses,
+                .llcMisses = llcMisses,
+                .checksum = checksum,
+            };
+        }
+    }
+
+    for (PerfCounter* counter : { &l1, &llc })
+    {
+        if (counter->fd >= 0)
+        {
+            close(counter->fd);
+        }
+    }
+
+    return best;
+}
+
+template<typename Grid>
+static void Fill(Grid* grid, size_t size)
+{
+    for (size_t y = 0; y < size; y++)
+    for (size_t x = 0; x < size; x++)
+    {
+        u32 random = RandomAt(1, 0, y * size + x);
+        if (random & 1)
+        {
+            grid->Set(x, y, InhabitantCell::Create(random >> 5));
+        }
+    }
+}
+
+template<typename Grid>
+static void Report(const Grid& grid, const BenchOptions& opts)
+{
+    f64 cells = (f64)opts.size * opts.size;
+
+    for (size_t i = 0; i <= opts.radii.size(); i++)
+    {
+        i32 radius = i == 0 ? 0 : opts.radii[i - 1];
+        BenchResult result = Measure(grid, radius, opts);
+
+        std::string neighbourhood = radius == 0
+                                  ? "cross"
+                                  : "r" + std::to_string(radius);
+
+        printf("%-10s %-6s %-6s %10.2f", Grid::name,
+                opts.chunkOrder ? "chunks" : "rows",
+                neighbourhood.c_str(), result.seconds * 1000.0);
+
+        for (i64 misses : { result.l1Misses, result.llcMisses })
+        {
+            if (misses < 0)
+            {
+                printf(" %10s", "n/a");
+            }
+            else
+            {
+                printf(" %10.4f", misses / cells);
+            }
+        }
+        printf("   %llu\n", (unsigned long long)result.checksum);
+    }
+}
+
+template<typename Layout>
+struct NamedGrid : ChunkedGrid<InhabitantCell, Layout>
+{
+    static constexpr const char* name = Layout::name;
+};
+
+int main(int argc, const char** argv)
+{
+    BenchOptions opts = {};
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (strcmp(arg, "--size") == 0 && hasValue)
+        {
+            opts.size = strtoull(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(arg, "--radius") == 0 && hasValue)
+        {
+            opts.radii.push_back(atoi(argv[++i]));
+        }
+        else if (strcmp(arg, "--reps") == 0 && hasValue)
+        {
+            opts.reps = std::max(1, atoi(argv[++i]));
+        }
+        else if (strcmp(arg, "--order") == 0 && hasValue)
+        {
+            const char* order = argv[++i];
+            if (strcmp(order, "rows") != 0 && strcmp(order, "chunks") != 0)
+            {
+                PrintUsage(argv[0]);
+                return 1;
+            }
+            opts.chunkOrder = strcmp(order, "chunks") == 0;
+        }
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (opts.size < 2 || opts.size > gMaxWorldSize)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    for (i32 radius : opts.radii)
+    {
+        if (radius < 1 || (size_t)radius * 2 >= opts.size)
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    V2<size_t> dimensions = { opts.size, opts.size };
+
+    printf("%-10s %-6s %-6s %10s %10s %10s   %s\n", "layout", "order",
+            "cells", "ms/sweep", "L1d/cell", "LLC/cell", "checksum");
+
+    // One grid at a time, so only one is ever in memory
+    {
+        FlatGrid grid = {
+            .dimensions = dimensions,
+            .cells = std::vector<InhabitantCell>(opts.size * opts.size),
+        };
+        Fill(&grid, opts.size);
+        Report(grid, opts);
+    }
+
+    {
+        NamedGrid<RowMajorLayout> grid = {
+            ChunkedGrid<InhabitantCell, RowMajorLayout>::Create(dimensions)
+        };
+        Fill(&grid, opts.size);
+        Report(grid, opts);
+    }
+
+    {
+        NamedGrid<MortonLayout> grid = {
+            ChunkedGrid<InhabitantCell, MortonLayout>::Create(dimensions)
+        };
+        Fill(&grid, opts.size);
+        Report(grid, opts);
+    }
+
+    return 0;
+}
@@ -17,13 +17,17 @@
 
 int main(int argc, const char** argv)
 {
-    srand(time(0));
-
     InitWindow(1920, 1080, "Schelling Test");
 
     SetTargetFPS(30);
     
-    Game game = Game::Create();
+    Game game = Game::Create(time(0));
+
+    // schelling [MOVELOG] plays a recorded run back
+    if (argc > 1 && !game.StartReplay(argv[1]))
+    {
+        exit(1);
+    }
 
     nk_context* ctx = InitNuklear(12);
     SetNuklearScaling(ctx, 2.0f);
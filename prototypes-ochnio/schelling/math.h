@@ -1,6 +1,4 @@
 #pragma once
-#include "raylib.h"
-#include "raymath.h"
 #include "gametypes.h"
 
 #include <cassert>
@@ -24,22 +22,11 @@ struct V3
     T x, y, z = 0;
 };
 
+template<typename T>
 inline
-bool RayIntersectionPlane(Ray ray, Vector3 planeNormal, Vector3* outPosition)
+V2<T> V2Lerp(V2<T> from, V2<T> to, f32 amount)
 {
-    bool hit = false;
-
-    float denom = Vector3DotProduct(planeNormal, ray.direction);
-    if (fabs(denom) > 0.0001f)
-    {
-        float t = Vector3DotProduct(Vector3Subtract((Vector3){0,0,0}, ray.position), planeNormal) / denom;
-        if (t >= 0)
-        {
-            *outPosition = Vector3Add(ray.position, Vector3Scale(ray.direction, t));
-            hit = true;
-        }
-    }
-
-    return hit;
+    return { from.x + (to.x - from.x) * amount,
+             from.y + (to.y - from.y) * amount };
 }
 
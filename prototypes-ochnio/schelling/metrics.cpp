@@ -0,0 +1,93 @@
+#include "metrics.h"
+
+#include <cassert>
+
+SegregationMetrics SegregationMetrics::Create(V2<size_t> dimensions,
+                                              size_t archetypeCount)
+{
+    size_t blocksPerRow = (dimensions.x + gMetricsBlockSize - 1)
+                        / gMetricsBlockSize;
+    size_t blockRows = (dimensions.y + gMetricsBlockSize - 1)
+                     / gMetricsBlockSize;
+    size_t blocks = blocksPerRow * blockRows;
+
+    return {
+        .archetypeCount = archetypeCount,
+        .blocksPerRow = blocksPerRow,
+        .blockCounts = std::vector<u32>(blocks * archetypeCount, 0),
+        .blockTotals = std::vector<u32>(blocks, 0),
+        .archetypeTotals = std::vector<u64>(archetypeCount, 0),
+        .pairs = std::vector<u64>(archetypeCount * archetypeCount, 0),
+        .pairTotals = std::vector<u64>(archetypeCount, 0),
+    };
+}
+
+u64 SegregationMetrics::BlockTerms(size_t block)
+{
+    const u32* counts = &blockCounts[block * archetypeCount];
+    u64 blockTotal = blockTotals[block];
+
+    u64 terms = 0;
+    for (size_t a = 0; a < archetypeCount; a++)
+    {
+        u64 actual = total * counts[a];
+        u64 even = blockTotal * archetypeTotals[a];
+        terms += actual > even ? actual - even : even - actual;
+    }
+    return terms;
+}
+
+void SegregationMetrics::RecountDissimilarity()
+{
+    // 2 T sum P_a (1 - P_a) multiplied out by total twice, the terms are
+    // too
+    spread = 0;
+    for (u64 count : archetypeTotals)
+    {
+        spread += count * (total - count);
+    }
+
+    dissimilarityTerms = 0;
+    for (size_t block = 0; block < blockTotals.size(); block++)
+    {
+        dissimilarityTerms += BlockTerms(block);
+    }
+}
+
+void SegregationMetrics::MoveBlock(V2<i32> origin,
+                                   V2<i32> destination,
+                                   ArchetypeIndex type)
+{
+    size_t from = BlockOf(origin);
+    size_t to = BlockOf(destination);
+
+    // Most moves stay inside their block
+    if (from == to)
+    {
+        return;
+    }
+
+    dissimilarityTerms -= BlockTerms(from) + BlockTerms(to);
+
+    blockCounts[from * archetypeCount + type]--;
+    blockTotals[from]--;
+    blockCounts[to * archetypeCount + type]++;
+    blockTotals[to]++;
+
+    dissimilarityTerms += BlockTerms(from) + BlockTerms(to);
+}
+
+f64 SegregationMetrics::Dissimilarity()
+{
+    return spread > 0 ? (f64)dissimilarityTerms / (2.0 * spread) : 0.0;
+}
+
+f64 SegregationMetrics::Exposure(ArchetypeIndex a, ArchetypeIndex b)
+{
+    assert(a < archetypeCount && b < archetypeCount);
+
+    u64 neighbours = pairTotals[a];
+    return neighbours > 0
+                ? (f64)pairs[a * archetypeCount + b] / neighbours
+                : 0.0;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <vector>
+
+#include "gametypes.h"
+#include "math.h"
+#include "inhabitantstore.h"
+
+
+// Side of the square blocks the dissimilarity index treats as areas
+constexpr size_t gMetricsBlockSize = 16;
+
+// Segregation measures of the whole grid, kept up to date move by move
+// by InhabitantSystem so reading them never costs more than a division.
+//
+// Dissimilarity is the multi group index over blocks of
+// gMetricsBlockSize cells: the share of inhabitants that would have to
+// move for every block to have the global mix, scaled to [0, 1]. With two
+// archetypes it is the classic 1/2 sum |a_i/A - b_i/B|.
+//
+// Exposure and isolation use the simulation's own neighbourhood instead
+// of blocks: of the neighbours archetype a has, the fraction that are b
+// (a itself for isolation). Mixed boundary is the number of neighbouring
+// pairs of different archetypes.
+//
+// Everything is kept in integers so a million turns don't drift.
+struct SegregationMetrics
+{
+    size_t archetypeCount = 0;
+    size_t blocksPerRow = 0;
+
+    // Inhabitants per block and archetype, block major
+    std::vector<u32> blockCounts = {};
+    std::vector<u32> blockTotals = {};
+
+    // Fixed once populated, nobody changes archetype
+    std::vector<u64> archetypeTotals = {};
+    u64 total = 0;
+
+    // Sum over blocks and archetypes of |total * count - blockTotal * A|,
+    // the dissimilarity numerator scaled by total
+    u64 dissimilarityTerms = 0;
+    u64 spread = 0;
+
+    // Neighbouring inhabitants as ordered pairs, a * archetypeCount + b.
+    // Every unordered pair is in twice
+    std::vector<u64> pairs = {};
+    std::vector<u64> pairTotals = {};
+    u64 mixedPairs = 0;
+
+    u64 happy = 0;
+
+    static
+    SegregationMetrics Create(V2<size_t> dimensions, size_t archetypeCount);
+
+    inline
+    size_t BlockOf(V2<i32> position)
+    {
+        return (position.y / gMetricsBlockSize) * blocksPerRow
+             + position.x / gMetricsBlockSize;
+    }
+
+    u64 BlockTerms(size_t block);
+
+    // Once blocks and totals are filled in
+    void RecountDissimilarity();
+
+    void MoveBlock(V2<i32> origin, V2<i32> destination, ArchetypeIndex type);
+
+    // Counts both orders of the pair
+    inline
+    void AddPair(ArchetypeIndex a, ArchetypeIndex b, i64 delta)
+    {
+        pairs[a * archetypeCount + b] += delta;
+        pairs[b * archetypeCount + a] += delta;
+        pairTotals[a] += delta;
+        pairTotals[b] += delta;
+
+        if (a != b)
+        {
+            mixedPairs += delta;
+        }
+    }
+
+    f64 Dissimilarity();
+    f64 Exposure(ArchetypeIndex a, ArchetypeIndex b);
+
+    inline
+    f64 Isolation(ArchetypeIndex a)
+    {
+        return Exposure(a, a);
+    }
+
+    inline
+    u64 MixedBoundary()
+    {
+        return mixedPairs;
+    }
+
+    inline
+    f64 HappyFraction()
+    {
+        return total > 0 ? (f64)happy / total : 1.0;
+    }
+};
@@ -0,0 +1,516 @@
+#include "movelog.h"
+
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <string>
+
+static void PutVarint(std::vector<u8>* out, u64 value)
+{
+    while (value >= 0x80)
+    {
+        out->push_back((u8)value | 0x80);
+        value >>= 7;
+    }
+    out->push_back((u8)value);
+}
+
+static bool GetVarint(FILE* file, u64* value)
+{
+    u64 result = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        int byte = getc_unlocked(file);
+        if (byte == EOF)
+        {
+            return false;
+        }
+
+        // The tenth byte only has room for the top bit
+        if (shift == 63 && (byte & 0x7e))
+        {
+            return false;
+        }
+
+        result |= (u64)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+        {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+static u8 DirectionOf(V2<i32> origin, V2<i32> destination)
+{
+    for (int i = 0; i < gNeighbourCount; i++)
+    {
+        if (origin.x + gNeighbourOffsets[i].x == destination.x
+            && origin.y + gNeighbourOffsets[i].y == destination.y)
+        {
+            return i;
+        }
+    }
+    return gJumpDirection;
+}
+
+static MoveBatch::Keyframe TakeKeyframe(u64 turn, const InhabitantStore& store)
+{
+    return {
+        .record = { .turn = turn },
+        .x = store.x,
+        .y = store.y,
+    };
+}
+
+std::shared_ptr<MoveRecorder>
+MoveRecorder::Create(const char* path,
+                     InhabitantSystem* system,
+                     u64 keyframeInterval)
+{
+    assert(keyframeInterval > 0);
+
+    std::string keysPath = std::string(path) + ".keys";
+
+    FILE* file = fopen(path, "wb");
+    FILE* keys = fopen(keysPath.c_str(), "wb");
+    if (!file || !keys)
+    {
+        fprintf(stderr, "can't write move log %s\n", path);
+        if (file)
+        {
+            fclose(file);
+        }
+        if (keys)
+        {
+            fclose(keys);
+        }
+        return nullptr;
+    }
+
+    InhabitantStore& store = system->inhabitants;
+
+    MoveLogHeader header = {
+        .version = gMoveLogVersion,
+        .headerSize = sizeof(MoveLogHeader),
+        .seed = system->seed,
+        .firstTurn = system->turnCount,
+        .width = (u32)system->dimensions.x,
+        .height = (u32)system->dimensions.y,
+        .inhabitantCount = store.Count(),
+    };
+    memcpy(header.magic, gMoveLogMagic, sizeof(header.magic));
+
+    KeyframeHeader keyHeader = {
+        .version = gKeyframeVersion,
+        .headerSize = sizeof(KeyframeHeader),
+        .interval = keyframeInterval,
+        .firstTurn = system->turnCount,
+        .inhabitantCount = store.Count(),
+    };
+    memcpy(keyHeader.magic, gKeyframeMagic, sizeof(keyHeader.magic));
+
+    std::shared_ptr<MoveRecorder> recorder = std::make_shared<MoveRecorder>();
+    recorder->file = file;
+    recorder->keys = keys;
+    recorder->dimensions = system->dimensions;
+    recorder->firstTurn = system->turnCount;
+    recorder->keyframeInterval = keyframeInterval;
+    recorder->lastTurn = system->turnCount;
+    recorder->logWritten = sizeof(MoveLogHeader);
+
+    // The starting state is the first keyframe, replays never depend on
+    // how it came about
+    MoveBatch::Keyframe first = TakeKeyframe(system->turnCount, store);
+    first.record.logOffset = sizeof(MoveLogHeader);
+
+    size_t count = store.Count();
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+           && fwrite(&keyHeader, sizeof(keyHeader), 1, keys) == 1
+           && fwrite(store.archetype.data(), sizeof(ArchetypeIndex),
+                     count, keys) == count
+           && recorder->WriteKeyframe(first);
+
+    if (!ok)
+    {
+        // Nothing to flush, the destructor only closes the files
+        fprintf(stderr, "can't write move log %s\n", path);
+        return nullptr;
+    }
+
+    recorder->writer = std::thread([r = recorder.get()] { r->WriterLoop(); });
+
+    return recorder;
+}
+
+MoveRecorder::~MoveRecorder()
+{
+    if (writer.joinable())
+    {
+        Flush();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        writer.join();
+    }
+
+    bool closed = fclose(file) == 0;
+    closed = fclose(keys) == 0 && closed;
+
+    if (!closed || failed)
+    {
+        fprintf(stderr, "move log is incomplete\n");
+    }
+}
+
+void MoveRecorder::RecordTurn(u64 turn,
+                              const std::vector<MovingInhabitant>& moves,
+                              const InhabitantStore& store)
+{
+    filling.turns.push_back(turn);
+    filling.turnMoves.push_back(moves.size());
+    filling.moves.insert(filling.moves.end(), moves.begin(), moves.end());
+
+    if ((turn - firstTurn) % keyframeInterval == 0)
+    {
+        MoveBatch::Keyframe keyframe = TakeKeyframe(turn, store);
+        keyframe.afterTurn = filling.turns.size() - 1;
+        filling.keyframes.push_back(std::move(keyframe));
+    }
+
+    if (filling.moves.size() >= gMoveBatchSize)
+    {
+        HandOff();
+    }
+}
+
+void MoveRecorder::HandOff()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this] { return !writingFull; });
+
+        std::swap(filling, writing);
+        writingFull = true;
+    }
+    wake.notify_one();
+
+    // The writer left it encoded and written, only the capacity is kept
+    filling.moves.clear();
+    filling.turns.clear();
+    filling.turnMoves.clear();
+    filling.keyframes.clear();
+}
+
+void MoveRecorder::Flush()
+{
+    if (!filling.turns.empty())
+    {
+        HandOff();
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return !writingFull; });
+    fflush(file);
+    fflush(keys);
+}
+
+void MoveRecorder::WriterLoop()
+{
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return writingFull || stopping; });
+
+            if (!writingFull)
+            {
+                return;
+            }
+        }
+
+        Encode(&writing);
+
+        if (fwrite(encoded.data(), 1, encoded.size(), file) != encoded.size())
+        {
+            failed = true;
+        }
+        logWritten += encoded.size();
+
+        // After the log, a keyframe never points past what was written
+        for (MoveBatch::Keyframe& keyframe : writing.keyframes)
+        {
+            failed = !WriteKeyframe(keyframe) || failed;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            writingFull = false;
+        }
+        idle.notify_all();
+    }
+}
+
+void MoveRecorder::Encode(MoveBatch* batch)
+{
+    encoded.clear();
+
+    size_t keyframe = 0;
+    size_t first = 0;
+    for (size_t t = 0; t < batch->turns.size(); t++)
+    {
+        u64 turn = batch->turns[t];
+        u32 count = batch->turnMoves[t];
+
+        sorted.assign(batch->moves.begin() + first,
+                      batch->moves.begin() + first + count);
+        first += count;
+
+        std::sort(sorted.begin(), sorted.end(),
+                  [](const MovingInhabitant& a, const MovingInhabitant& b)
+                  {
+                      return a.id < b.id;
+                  });
+
+        PutVarint(&encoded, turn - lastTurn);
+        PutVarint(&encoded, count);
+        lastTurn = turn;
+
+        directions.resize(count);
+
+        InhabitantID previous = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            MovingInhabitant& move = sorted[i];
+            directions[i] = DirectionOf(move.origin, move.destination);
+
+            bool jump = directions[i] == gJumpDirection;
+            PutVarint(&encoded, ((u64)(move.id - previous) << 1) | jump);
+            previous = move.id;
+        }
+
+        u8 packed = 0;
+        int lanes = 0;
+        for (u8 direction : directions)
+        {
+            if (direction == gJumpDirection)
+            {
+                continue;
+            }
+
+            packed |= direction << (lanes * 2);
+            if (++lanes == 4)
+            {
+                encoded.push_back(packed);
+                packed = 0;
+                lanes = 0;
+            }
+        }
+        if (lanes > 0)
+        {
+            encoded.push_back(packed);
+        }
+
+        for (size_t i = 0; i < count; i++)
+        {
+            if (directions[i] == gJumpDirection)
+            {
+                V2<i32> destination = sorted[i].destination;
+                PutVarint(&encoded, destination.y * dimensions.x
+                                    + destination.x);
+            }
+        }
+
+        for (; keyframe < batch->keyframes.size()
+               && batch->keyframes[keyframe].afterTurn == t; keyframe++)
+        {
+            batch->keyframes[keyframe].record.logOffset = logWritten
+                                                        + encoded.size();
+        }
+    }
+}
+
+bool MoveRecorder::WriteKeyframe(const MoveBatch::Keyframe& keyframe)
+{
+    size_t count = keyframe.x.size();
+    return fwrite(&keyframe.record, sizeof(KeyframeRecord), 1, keys) == 1
+        && fwrite(keyframe.x.data(), sizeof(u16), count, keys) == count
+        && fwrite(keyframe.y.data(), sizeof(u16), count, keys) == count;
+}
+
+bool MoveLogReader::Open(const char* path, MoveLogReader* reader)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        fprintf(stderr, "can't open move log %s\n", path);
+        return false;
+    }
+
+    MoveLogHeader header = {};
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, gMoveLogMagic, sizeof(header.magic)) != 0
+        || header.version != gMoveLogVersion
+        || header.headerSize != sizeof(MoveLogHeader)
+        || header.width == 0 || header.width > gMaxWorldSize
+        || header.height == 0 || header.height > gMaxWorldSize
+        || header.inhabitantCount > (u64)header.width * header.height)
+    {
+        fprintf(stderr, "%s is not a version %u move log\n",
+                path, gMoveLogVersion);
+        fclose(file);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    u64 size = ftell(file);
+    fseek(file, sizeof(header), SEEK_SET);
+
+    *reader = {
+        .file = file,
+        .header = header,
+        .size = size,
+        .turn = header.firstTurn,
+    };
+    return true;
+}
+
+void MoveLogReader::Close()
+{
+    if (file)
+    {
+        fclose(file);
+    }
+    file = nullptr;
+}
+
+bool MoveLogReader::NextTurn(u64* turnOut, std::vector<LoggedMove>* moves)
+{
+    moves->clear();
+
+    // The end of the log, unless a record was started
+    u64 turnDelta = 0;
+    if (!GetVarint(file, &turnDelta))
+    {
+        return false;
+    }
+
+    if (!ReadTurn(turnDelta, moves))
+    {
+        fprintf(stderr, "move log is corrupt after turn %llu\n",
+                (unsigned long long)turn);
+
+        moves->clear();
+        End();
+        return false;
+    }
+
+    turn += turnDelta;
+    *turnOut = turn;
+    return true;
+}
+
+bool MoveLogReader::ReadTurn(u64 turnDelta, std::vector<LoggedMove>* moves)
+{
+    u64 inhabitants = header.inhabitantCount;
+    u64 cells = (u64)header.width * header.height;
+
+    // Every inhabitant moves at most once a turn
+    u64 count = 0;
+    if (turnDelta == 0
+        || !GetVarint(file, &count)
+        || count > inhabitants)
+    {
+        return false;
+    }
+
+    moves->resize(count);
+
+    // Ids go up strictly, only the first one is stored as itself
+    u64 previous = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        u64 code = 0;
+        if (!GetVarint(file, &code))
+        {
+            return false;
+        }
+
+        u64 step = code >> 1;
+        if ((i > 0 && step == 0) || step >= inhabitants - previous)
+        {
+            return false;
+        }
+
+        LoggedMove& move = (*moves)[i];
+        move.id = (InhabitantID)(previous + step);
+        move.direction = (code & 1) ? gJumpDirection : 0;
+        previous = move.id;
+    }
+
+    int lanes = 4;
+    int packed = 0;
+    for (LoggedMove& move : *moves)
+    {
+        if (move.direction == gJumpDirection)
+        {
+            continue;
+        }
+
+        if (lanes == 4)
+        {
+            packed = getc_unlocked(file);
+            if (packed == EOF)
+            {
+                return false;
+            }
+            lanes = 0;
+        }
+
+        move.direction = (packed >> (lanes * 2)) & 3;
+        lanes++;
+    }
+
+    // Lanes the last byte doesn't use are written as 0
+    if (lanes < 4 && (packed >> (lanes * 2)) != 0)
+    {
+        return false;
+    }
+
+    for (LoggedMove& move : *moves)
+    {
+        if (move.direction != gJumpDirection)
+        {
+            continue;
+        }
+
+        u64 destination = 0;
+        if (!GetVarint(file, &destination) || destination >= cells)
+        {
+            return false;
+        }
+        move.destination = destination;
+    }
+
+    return true;
+}
+
+u64 MoveLogReader::Offset()
+{
+    return ftell(file);
+}
+
+void MoveLogReader::Seek(u64 offset, u64 turnBefore)
+{
+    fseek(file, offset, SEEK_SET);
+    turn = turnBefore;
+}
+
+void MoveLogReader::End()
+{
+    fseek(file, 0, SEEK_END);
+}
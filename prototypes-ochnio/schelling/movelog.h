@@ -0,0 +1,200 @@
+#pragma once
+
+#include <cstdio>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+
+#include "gametypes.h"
+#include "inhabitant.h"
+
+
+// Every move of every turn, compact enough to keep whole trajectories.
+// After the header the file is a sequence of turn records:
+//   varint  turn, minus the previous record's turn
+//   varint  move count
+//   varint  per move, sorted by id: id minus the previous id, shifted
+//           left once, low bit set for a jump
+//   bytes   2 bit gNeighbourOffsets index per adjacent move, four a byte
+//   varint  per jump, the destination cell index
+// Every inhabitant moves at most once a turn. Apart from asynchronous
+// turns, whose moves can follow each other into the cells they leave
+// (replay puts those back in order), destinations are empty when
+// claimed, so the order is free and sorting makes ids small.
+// Origins aren't stored, whoever replays knows where everyone stands.
+//
+// Next to the log, in PATH.keys, go keyframes: the header, every
+// inhabitant's archetype, then for the first turn and every interval
+// turns after it a KeyframeRecord followed by the x and y columns.
+// Records are all the same size, keyframe k sits at a computed offset.
+
+constexpr char gMoveLogMagic[8] = { 'S', 'C', 'H', 'M', 'O', 'V', 'E', 'S' };
+constexpr u32 gMoveLogVersion = 1;
+
+// Recorded moves are handed to the writer this many at a time
+constexpr size_t gMoveBatchSize = 1 << 16;
+
+constexpr u8 gJumpDirection = 0xff;
+
+constexpr char gKeyframeMagic[8] = { 'S', 'C', 'H', 'K', 'E', 'Y', 'F', 'R' };
+constexpr u32 gKeyframeVersion = 1;
+
+// Turns between keyframes, what a seek replays at most
+constexpr u64 gKeyframeInterval = 64;
+
+struct MoveLogHeader
+{
+    char magic[8] = {};
+    u32 version = 0;
+    u32 headerSize = 0;
+
+    u64 seed = 0;
+
+    // Turn the system was at when recording started, records are for
+    // the turns after it
+    u64 firstTurn = 0;
+
+    u32 width = 0;
+    u32 height = 0;
+    u64 inhabitantCount = 0;
+};
+
+struct KeyframeHeader
+{
+    char magic[8] = {};
+    u32 version = 0;
+    u32 headerSize = 0;
+
+    u64 interval = 0;
+    u64 firstTurn = 0;
+    u64 inhabitantCount = 0;
+};
+
+struct KeyframeRecord
+{
+    u64 turn = 0;
+
+    // Byte offset in the move log of the first turn after this one
+    u64 logOffset = 0;
+};
+
+struct LoggedMove
+{
+    InhabitantID id = InvalidId;
+
+    // gNeighbourOffsets index, or gJumpDirection
+    u8 direction = gJumpDirection;
+
+    // Cell index, only for jumps
+    u32 destination = 0;
+};
+
+// Raw moves of whole turns, filled by the simulation thread, encoded and
+// written by the writer thread
+struct MoveBatch
+{
+    std::vector<MovingInhabitant> moves = {};
+
+    // Turn number and how many of moves belong to it, in order
+    std::vector<u64> turns = {};
+    std::vector<u32> turnMoves = {};
+
+    // Positions after some of the turns, taken every keyframe interval
+    struct Keyframe
+    {
+        size_t afterTurn = 0;
+        KeyframeRecord record = {};
+        std::vector<u16> x = {};
+        std::vector<u16> y = {};
+    };
+    std::vector<Keyframe> keyframes = {};
+};
+
+// Appends every turn of an InhabitantSystem to a move log. The turn loop
+// only copies moves into one of two buffers, a writer thread encodes and
+// writes the other one.
+struct MoveRecorder
+{
+    FILE* file = nullptr;
+    FILE* keys = nullptr;
+    V2<size_t> dimensions = {};
+    u64 firstTurn = 0;
+    u64 keyframeInterval = 0;
+
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+
+    MoveBatch filling = {};
+    MoveBatch writing = {};
+    bool writingFull = false;
+    bool stopping = false;
+    bool failed = false;
+
+    // Writer thread only
+    u64 lastTurn = 0;
+    u64 logWritten = 0;
+    std::vector<u8> encoded = {};
+    std::vector<MovingInhabitant> sorted = {};
+    std::vector<u8> directions = {};
+
+    static
+    std::shared_ptr<MoveRecorder> Create(const char* path,
+                                         InhabitantSystem* system,
+                                         u64 keyframeInterval
+                                                    = gKeyframeInterval);
+
+    // Writes out whatever is left
+    ~MoveRecorder();
+
+    // store is where everyone stands once the turn's moves are applied
+    void RecordTurn(u64 turn,
+                    const std::vector<MovingInhabitant>& moves,
+                    const InhabitantStore& store);
+
+    // Blocks until everything recorded so far is in the file
+    void Flush();
+
+    void HandOff();
+    void WriterLoop();
+    void Encode(MoveBatch* batch);
+    bool WriteKeyframe(const MoveBatch::Keyframe& keyframe);
+};
+
+struct MoveLogReader
+{
+    FILE* file = nullptr;
+    MoveLogHeader header = {};
+
+    // Of the whole file, as it was when opened
+    u64 size = 0;
+
+    // Turn of the last record read
+    u64 turn = 0;
+
+    static
+    bool Open(const char* path, MoveLogReader* reader);
+
+    void Close();
+
+    // Reads the next turn record, false at the end of the log. A record
+    // that is cut short or doesn't fit the header (ids out of range or
+    // not ascending, a jump off the grid, more moves than inhabitants) is
+    // reported and ends the log there. Whether the moves fit where
+    // everyone stands is up to the replay
+    bool NextTurn(u64* turn, std::vector<LoggedMove>* moves);
+
+    // The rest of the record after its turn delta, false if it's corrupt
+    bool ReadTurn(u64 turnDelta, std::vector<LoggedMove>* moves);
+
+    // Byte offset of the next record and the turn before it, to come
+    // back to with Seek
+    u64 Offset();
+    void Seek(u64 offset, u64 turnBefore);
+
+    // Makes this the end of the log, for when nothing after can be trusted
+    void End();
+};
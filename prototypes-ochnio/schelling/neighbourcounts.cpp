@@ -0,0 +1,58 @@
+#include <cstring>
+
+#include "neighbourcounts.h"
+
+NeighbourCountGrid
+NeighbourCountGrid::Create(V2<size_t> dimensions, size_t archetypeCount)
+{
+    size_t cellCount = dimensions.x * dimensions.y;
+
+    return {
+        .dimensions = dimensions,
+        .archetypeCount = archetypeCount,
+        .counts = std::vector<u8>(cellCount * archetypeCount, 0),
+        .totals = std::vector<u8>(cellCount, 0),
+    };
+}
+
+bool NeighbourCountGrid::Page(const char* path, size_t capacity)
+{
+    assert(!pager);
+
+    size_t chunksPerRow = (dimensions.x + gChunkSize - 1) >> gChunkShift;
+    size_t bandCount = (dimensions.y + gChunkSize - 1) >> gChunkShift;
+    size_t bandCells = gChunkSize * dimensions.x;
+    size_t bandBytes = bandCells * (archetypeCount + 1);
+
+    std::vector<u8> fillBand(bandBytes, 0);
+    pager = ChunkPager::Create(path, bandCount, bandBytes, fillBand.data(),
+                               std::max<size_t>(3, capacity / chunksPerRow));
+    if (!pager)
+    {
+        return false;
+    }
+
+    // Bands of nothing but zeros stay fill
+    for (size_t band = 0; band < bandCount; band++)
+    {
+        size_t first = band * bandCells;
+        size_t cells = std::min(bandCells, totals.size() - first);
+
+        bool empty = std::all_of(totals.begin() + first,
+                                 totals.begin() + first + cells,
+                                 [](u8 total) { return total == 0; });
+        if (empty)
+        {
+            continue;
+        }
+
+        u8* data = pager->Fetch(band, true);
+        memcpy(data, &counts[first * archetypeCount],
+               cells * archetypeCount);
+        memcpy(data + bandCells * archetypeCount, &totals[first], cells);
+    }
+
+    counts = {};
+    totals = {};
+    return true;
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cassert>
+
+#include "gametypes.h"
+#include "math.h"
+#include "inhabitantstore.h"
+#include "chunkedgrid.h"
+
+
+// Von Neumann neighbourhood every score is computed over
+constexpr i32 gNeighbourCount = 4;
+constexpr V2<i32> gNeighbourOffsets[gNeighbourCount] =
+{
+    {  0,  1 }, // Up
+    {  0, -1 }, // Down
+    {  1,  0 }, // Right
+    { -1,  0 }, // Left
+};
+
+inline bool IsAdjacent(V2<i32> a, V2<i32> b)
+{
+    i32 dx = a.x - b.x;
+    i32 dy = a.y - b.y;
+    return (dx * dx + dy * dy) == 1;
+}
+
+// Per cell count of inhabitants of every archetype in the cell's
+// neighbourhood. Updated locally whenever an inhabitant appears or leaves
+// a cell, so scoring is a table lookup rather than probing the neighbours.
+//
+// Once paged (see Page) the grid lives in a file in bands of gChunkSize
+// rows, the same rows as a row of cell chunks, each band its rows' counts
+// then their totals. Only the most recently used bands are in memory.
+struct NeighbourCountGrid
+{
+    V2<size_t> dimensions = {};
+    size_t archetypeCount = 0;
+
+    // archetypeCount counts per cell, one cell after another
+    std::vector<u8> counts = {};
+
+    // Occupied neighbours per cell, the sum of the cell's counts
+    std::vector<u8> totals = {};
+
+    // Empty vectors above once set
+    std::shared_ptr<ChunkPager> pager = {};
+
+    // A cell's counts and its total
+    struct Cell
+    {
+        u8* counts;
+        u8* total;
+    };
+
+    static
+    NeighbourCountGrid Create(V2<size_t> dimensions, size_t archetypeCount);
+
+    // Moves the grid into a file, keeping as many bands in memory as
+    // capacity cell chunks cover rows of, at least three
+    bool Page(const char* path, size_t capacity);
+
+    inline
+    size_t Index(int x, int y)
+    {
+        return (y * dimensions.x) + x;
+    }
+
+    // Marks the cell's band changed when write is set. When paged the
+    // pointers last until the next lookup of any cell
+    inline
+    Cell Lookup(int x, int y, bool write)
+    {
+        if (!pager)
+        {
+            size_t index = Index(x, y);
+            return { &counts[index * archetypeCount], &totals[index] };
+        }
+
+        u8* band = pager->Fetch(y >> gChunkShift, write);
+        size_t index = (y & (gChunkSize - 1)) * dimensions.x + x;
+        u8* bandTotals = band + gChunkSize * dimensions.x * archetypeCount;
+        return { band + index * archetypeCount, bandTotals + index };
+    }
+
+    inline
+    u8 CountAt(int x, int y, ArchetypeIndex archetype)
+    {
+        return Lookup(x, y, false).counts[archetype];
+    }
+
+    inline
+    u8 TotalAt(int x, int y)
+    {
+        return *Lookup(x, y, false).total;
+    }
+
+    // Same kind minus other kind neighbours of (x, y) for archetype
+    inline
+    i32 NetAt(int x, int y, ArchetypeIndex archetype)
+    {
+        Cell cell = Lookup(x, y, false);
+        return 2 * cell.counts[archetype] - *cell.total;
+    }
+
+    // Starts loading the counts of (x, y) and the cells above and below
+    // into the cache, for callers that know what they score next. Never
+    // pages a band in
+    inline
+    void Prefetch(int x, int y)
+    {
+        if (pager)
+        {
+            return;
+        }
+
+        for (int dy = -1; dy <= 1; dy++)
+        {
+            if (y + dy < 0 || y + dy >= (i32)dimensions.y)
+            {
+                continue;
+            }
+
+            size_t index = Index(x, y + dy);
+            __builtin_prefetch(&counts[index * archetypeCount]);
+            __builtin_prefetch(&totals[index]);
+        }
+    }
+
+    // An inhabitant of archetype now stands at position
+    inline
+    void Add(V2<i32> position, ArchetypeIndex archetype)
+    {
+        Update(position, archetype, 1);
+    }
+
+    // An inhabitant of archetype left position
+    inline
+    void Remove(V2<i32> position, ArchetypeIndex archetype)
+    {
+        Update(position, archetype, -1);
+    }
+
+    // Recomputes the counts of row y from scratch. archetypeAt(x, y) gives
+    // the archetype standing at a cell or -1 when it's empty. Only row y
+    // is written, so different rows can be recounted in parallel, unless
+    // paged
+    template<typename ArchetypeAtFn>
+    void RecountRow(i32 y, ArchetypeAtFn&& archetypeAt)
+    {
+        for (i32 x = 0; x < (i32)dimensions.x; x++)
+        {
+            Cell cell = Lookup(x, y, true);
+
+            std::fill(cell.counts, cell.counts + archetypeCount, 0);
+            *cell.total = 0;
+
+            for (int i = 0; i < gNeighbourCount; i++)
+            {
+                i32 nx = x + gNeighbourOffsets[i].x;
+                i32 ny = y + gNeighbourOffsets[i].y;
+
+                if (nx < 0 || nx >= (i32)dimensions.x
+                    || ny < 0 || ny >= (i32)dimensions.y)
+                {
+                    continue;
+                }
+
+                i32 archetype = archetypeAt(nx, ny);
+                if (archetype >= 0)
+                {
+                    cell.counts[archetype]++;
+                    (*cell.total)++;
+                }
+            }
+        }
+    }
+
+    inline
+    void Update(V2<i32> position, ArchetypeIndex archetype, i32 delta)
+    {
+        assert(archetype < archetypeCount);
+
+        for (int i = 0; i < gNeighbourCount; i++)
+        {
+            i32 x = position.x + gNeighbourOffsets[i].x;
+            i32 y = position.y + gNeighbourOffsets[i].y;
+
+            if (x < 0 || x >= (i32)dimensions.x
+                || y < 0 || y >= (i32)dimensions.y)
+            {
+                continue;
+            }
+
+            Cell cell = Lookup(x, y, true);
+            cell.counts[archetype] += delta;
+            *cell.total += delta;
+        }
+    }
+};
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <vector>
+#include <cassert>
+
+#include "gametypes.h"
+
+
+// Children per node, eight sums fill a cache line
+constexpr size_t gRateTreeFanout = 8;
+
+// Sum tree over per item rates. Level 0 holds the rates, every node above
+// the sum of gRateTreeFanout nodes below it, and the single top node the
+// total. Setting a rate and finding the item a point of [0, total) falls
+// on both walk one node per level, log8 of the item count.
+//
+// Sums are added up again from the children whenever one changes rather
+// than adjusted by the difference, so they never drift however many
+// times rates change.
+struct RateTree
+{
+    // Bottom up, every level padded to whole groups of children
+    std::vector<std::vector<f64>> levels = {};
+
+    static
+    RateTree Create(size_t count)
+    {
+        RateTree tree = {};
+
+        size_t width = count;
+        do
+        {
+            size_t groups = (width + gRateTreeFanout - 1) / gRateTreeFanout;
+            tree.levels.emplace_back(groups * gRateTreeFanout, 0.0);
+            width = groups;
+        }
+        while (width > 1);
+
+        tree.levels.emplace_back(1, 0.0);
+        return tree;
+    }
+
+    inline
+    f64 Total() const
+    {
+        return levels.back()[0];
+    }
+
+    inline
+    f64 RateOf(size_t item) const
+    {
+        return levels[0][item];
+    }
+
+    inline
+    f64 GroupSum(size_t level, size_t group) const
+    {
+        const f64* children = levels[level].data() + group * gRateTreeFanout;
+
+        f64 sum = 0.0;
+        for (size_t i = 0; i < gRateTreeFanout; i++)
+        {
+            sum += children[i];
+        }
+        return sum;
+    }
+
+    inline
+    void Set(size_t item, f64 rate)
+    {
+        assert(rate >= 0.0);
+
+        levels[0][item] = rate;
+
+        size_t node = item;
+        for (size_t level = 1; level < levels.size(); level++)
+        {
+            node /= gRateTreeFanout;
+            levels[level][node] = GroupSum(level - 1, node);
+        }
+    }
+
+    // Sums every level again, after rates were written straight into
+    // levels[0]
+    void Rebuild()
+    {
+        for (size_t level = 1; level < levels.size(); level++)
+        {
+            for (size_t node = 0; node < levels[level].size(); node++)
+            {
+                bool inside = node * gRateTreeFanout < levels[level - 1].size();
+                levels[level][node] = inside ? GroupSum(level - 1, node) : 0.0;
+            }
+        }
+    }
+
+    // Item whose share of [0, total) holds point, never one with rate 0.
+    // Total has to be above 0
+    inline
+    size_t Find(f64 point) const
+    {
+        assert(Total() > 0.0);
+
+        size_t node = 0;
+        for (size_t level = levels.size() - 1; level-- > 0; )
+        {
+            const f64* children = levels[level].data()
+                                + node * gRateTreeFanout;
+
+            // Rounding can leave point at or past the last sum, the last
+            // child with a rate takes it then
+            size_t chosen = gRateTreeFanout;
+            for (size_t i = 0; i < gRateTreeFanout; i++)
+            {
+                if (children[i] <= 0.0)
+                {
+                    continue;
+                }
+
+                chosen = i;
+                if (point < children[i])
+                {
+                    break;
+                }
+                point -= children[i];
+            }
+
+            assert(chosen < gRateTreeFanout);
+            node = node * gRateTreeFanout + chosen;
+        }
+
+        return node;
+    }
+};
@@ -0,0 +1,383 @@
+#include "replay.h"
+
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <string>
+
+// Logged moves only say where to, the origin is wherever the inhabitant
+// stands before the turn
+static MovingInhabitant ResolveMove(const LoggedMove& move,
+                                    InhabitantSystem* system)
+{
+    V2<i32> origin = system->inhabitants.PositionOf(move.id);
+    V2<i32> destination = move.direction == gJumpDirection
+        ? system->CellPosition(move.destination)
+        : V2<i32> { origin.x + gNeighbourOffsets[move.direction].x,
+                    origin.y + gNeighbourOffsets[move.direction].y };
+
+    return { .id = move.id, .destination = destination, .origin = origin };
+}
+
+// A turn's moves in an order they can be applied in, false if they can't
+// be. Only asynchronous turns move inhabitants into cells left in the
+// same turn, such a move has to come after the one out. The inhabitant
+// still standing in a destination has to be the one leaving it, logged
+// moves are sorted by id so its move is found by search. Recorded turns
+// never send two inhabitants to one cell nor form cycles (the first to
+// go went to an empty cell), a log that does is corrupt
+static bool ResolveTurn(const std::vector<LoggedMove>& moves,
+                        InhabitantSystem* system,
+                        std::vector<MovingInhabitant>* resolved)
+{
+    resolved->clear();
+
+    i32 width = (i32)system->dimensions.x;
+    i32 height = (i32)system->dimensions.y;
+
+    std::vector<u32> destinations = {};
+    destinations.reserve(moves.size());
+
+    bool chained = false;
+    for (const LoggedMove& move : moves)
+    {
+        resolved->push_back(ResolveMove(move, system));
+
+        V2<i32> destination = resolved->back().destination;
+        if (destination.x < 0 || destination.x >= width
+            || destination.y < 0 || destination.y >= height)
+        {
+            return false;
+        }
+
+        destinations.push_back(system->CellIndex(destination.x,
+                                                 destination.y));
+        chained |= !system->CellAt(destination.x, destination.y).IsEmpty();
+    }
+
+    std::sort(destinations.begin(), destinations.end());
+    if (std::adjacent_find(destinations.begin(), destinations.end())
+            != destinations.end())
+    {
+        return false;
+    }
+
+    if (!chained)
+    {
+        return true;
+    }
+
+    // Moves not looked at yet, in the chain being followed, placed
+    enum : u8 { Open, Following, Placed };
+
+    std::vector<MovingInhabitant> unordered = std::move(*resolved);
+    std::vector<u8> state(unordered.size(), Open);
+    std::vector<size_t> chain = {};
+
+    resolved->clear();
+    for (size_t i = 0; i < unordered.size(); i++)
+    {
+        // Down the chain to a move into an empty cell or one already
+        // placed, then placed from there back up
+        for (size_t at = i; state[at] != Placed; )
+        {
+            if (state[at] == Following)
+            {
+                return false;
+            }
+
+            state[at] = Following;
+            chain.push_back(at);
+
+            V2<i32> destination = unordered[at].destination;
+            InhabitantID leaving =
+                system->CellAt(destination.x, destination.y).Id();
+            if (leaving == InvalidId)
+            {
+                break;
+            }
+
+            auto next = std::lower_bound(unordered.begin(), unordered.end(),
+                leaving, [](const MovingInhabitant& move, InhabitantID id)
+                {
+                    return move.id < id;
+                });
+            if (next == unordered.end() || next->id != leaving)
+            {
+                return false;
+            }
+            at = next - unordered.begin();
+        }
+
+        for (size_t j = chain.size(); j-- > 0; )
+        {
+            state[chain[j]] = Placed;
+            resolved->push_back(unordered[chain[j]]);
+        }
+        chain.clear();
+    }
+
+    return true;
+}
+
+bool MoveReplay::Open(const char* path, MoveReplay* replay)
+{
+    MoveLogReader log = {};
+    if (!MoveLogReader::Open(path, &log))
+    {
+        return false;
+    }
+
+    std::string keysPath = std::string(path) + ".keys";
+    FILE* keys = fopen(keysPath.c_str(), "rb");
+    if (!keys)
+    {
+        fprintf(stderr, "can't open keyframes %s\n", keysPath.c_str());
+        log.Close();
+        return false;
+    }
+
+    KeyframeHeader header = {};
+    bool valid = fread(&header, sizeof(header), 1, keys) == 1
+              && memcmp(header.magic, gKeyframeMagic,
+                        sizeof(header.magic)) == 0
+              && header.version == gKeyframeVersion
+              && header.headerSize == sizeof(KeyframeHeader)
+              && header.interval > 0
+              && header.firstTurn == log.header.firstTurn
+              && header.inhabitantCount == log.header.inhabitantCount
+              && header.inhabitantCount <= gMaxCellInhabitants;
+
+    std::vector<ArchetypeIndex> archetypes(valid ? header.inhabitantCount : 0);
+    valid = valid
+         && fread(archetypes.data(), sizeof(ArchetypeIndex),
+                  archetypes.size(), keys) == archetypes.size();
+
+    if (!valid)
+    {
+        fprintf(stderr, "%s is not a version %u keyframe file\n",
+                keysPath.c_str(), gKeyframeVersion);
+        fclose(keys);
+        log.Close();
+        return false;
+    }
+
+    size_t archetypeCount = archetypes.empty()
+        ? 0 : *std::max_element(archetypes.begin(), archetypes.end()) + 1;
+
+    *replay = {
+        .log = log,
+        .keys = keys,
+        .keyHeader = header,
+        .archetypes = std::move(archetypes),
+        .archetypeCount = archetypeCount,
+    };
+
+    // A keyframe cut short by a crash doesn't count
+    fseek(keys, 0, SEEK_END);
+    u64 keysSize = ftell(keys);
+    u64 recordSize = replay->KeyframeOffset(1) - replay->KeyframeOffset(0);
+    replay->keyframeCount = keysSize >= replay->KeyframeOffset(0)
+                                ? (keysSize - replay->KeyframeOffset(0))
+                                        / recordSize
+                                : 0;
+
+    if (replay->keyframeCount == 0)
+    {
+        fprintf(stderr, "%s has no keyframes\n", keysPath.c_str());
+        replay->Close();
+        return false;
+    }
+
+    return true;
+}
+
+void MoveReplay::Close()
+{
+    log.Close();
+
+    if (keys)
+    {
+        fclose(keys);
+    }
+    keys = nullptr;
+}
+
+u64 MoveReplay::KeyframeOffset(u64 keyframe) const
+{
+    u64 count = keyHeader.inhabitantCount;
+    u64 recordSize = sizeof(KeyframeRecord) + 2 * count * sizeof(u16);
+
+    return sizeof(KeyframeHeader)
+         + count * sizeof(ArchetypeIndex)
+         + keyframe * recordSize;
+}
+
+bool MoveReplay::LoadKeyframe(u64 keyframe,
+                              InhabitantSystem* system,
+                              KeyframeRecord* record)
+{
+    InhabitantStore& store = system->inhabitants;
+    size_t count = archetypes.size();
+
+    fseek(keys, KeyframeOffset(keyframe), SEEK_SET);
+
+    // Keyframes come every interval turns and point into the log
+    bool ok = fread(record, sizeof(*record), 1, keys) == 1
+           && record->turn == FirstTurn() + keyframe * keyHeader.interval
+           && record->logOffset >= sizeof(MoveLogHeader)
+           && record->logOffset <= log.size
+           && fread(store.x.data(), sizeof(u16), count, keys) == count
+           && fread(store.y.data(), sizeof(u16), count, keys) == count;
+
+    // One thread, chunks are allocated as they are written. Two
+    // inhabitants on one cell would leave one of them nowhere
+    for (size_t id = 0; ok && id < count; id++)
+    {
+        u16 x = store.x[id];
+        u16 y = store.y[id];
+
+        ok = x < system->dimensions.x
+          && y < system->dimensions.y
+          && system->CellAt(x, y).IsEmpty();
+        if (ok)
+        {
+            system->SetCellAt(x, y, InhabitantCell::Create(id));
+        }
+    }
+
+    return ok;
+}
+
+bool MoveReplay::Seek(u64 turn, InhabitantSystem* system)
+{
+    const MoveLogHeader& header = log.header;
+
+    if (system->dimensions.x != header.width
+        || system->dimensions.y != header.height
+        || system->settings.archetypes.size() < archetypeCount)
+    {
+        fprintf(stderr, "replay is of a %u x %u world with %zu archetypes\n",
+                header.width, header.height, archetypeCount);
+        return false;
+    }
+
+    u64 keyframe = turn > FirstTurn()
+                    ? (turn - FirstTurn()) / keyHeader.interval
+                    : 0;
+    keyframe = std::min(keyframe, keyframeCount - 1);
+
+    size_t count = archetypes.size();
+
+    // Built from scratch like a restored checkpoint, derived state is
+    // rebuilt in one go rather than undone move by move
+    auto fresh = [&]
+    {
+        InhabitantSystem created =
+            InhabitantSystem::Create(system->settings, header.seed);
+        created.inhabitants.Resize(count);
+        created.inhabitants.archetype = archetypes;
+        return created;
+    };
+
+    InhabitantSystem seeked = fresh();
+    InhabitantStore& store = seeked.inhabitants;
+    KeyframeRecord record = {};
+
+    // A bad keyframe costs the shortcut, the log from the first one on
+    // still gets there
+    if (!LoadKeyframe(keyframe, &seeked, &record))
+    {
+        fprintf(stderr, "keyframe %llu is corrupt\n",
+                (unsigned long long)keyframe);
+        if (keyframe == 0)
+        {
+            return false;
+        }
+
+        fprintf(stderr, "replaying from the first keyframe\n");
+        seeked = fresh();
+        if (!LoadKeyframe(0, &seeked, &record))
+        {
+            fprintf(stderr, "keyframe 0 is corrupt\n");
+            return false;
+        }
+    }
+
+    seeked.turnCount = record.turn;
+    seeked.RebuildFromCells();
+
+    log.Seek(record.logOffset, record.turn);
+
+    std::vector<MovingInhabitant> resolved = {};
+
+    while (seeked.turnCount < turn)
+    {
+        u64 offset = log.Offset();
+        u64 turnBefore = log.turn;
+
+        u64 next = 0;
+        if (!log.NextTurn(&next, &moves))
+        {
+            break;
+        }
+
+        // Past the target, left for StartNextTurn
+        if (next > turn)
+        {
+            log.Seek(offset, turnBefore);
+            break;
+        }
+
+        if (!ResolveTurn(moves, &seeked, &resolved))
+        {
+            fprintf(stderr, "logged moves of turn %llu don't fit\n",
+                    (unsigned long long)next);
+            log.End();
+            break;
+        }
+
+        for (MovingInhabitant& move : resolved)
+        {
+            seeked.ApplyMove(move);
+        }
+        seeked.turnCount = next;
+    }
+
+    // The moved inhabitants' animation still shows where they came from
+    seeked.ParallelFor(count, [&](size_t id, u32)
+    {
+        store.animation[id].position = { (f32)store.x[id], (f32)store.y[id] };
+    });
+
+    *system = std::move(seeked);
+    return true;
+}
+
+bool MoveReplay::StartNextTurn(InhabitantSystem* system)
+{
+    if (system->turnInProgress)
+    {
+        return true;
+    }
+
+    u64 turn = 0;
+    if (!log.NextTurn(&turn, &moves))
+    {
+        return false;
+    }
+
+    if (!ResolveTurn(moves, system, &system->movingInhabitants))
+    {
+        fprintf(stderr, "logged moves of turn %llu don't fit\n",
+                (unsigned long long)turn);
+        system->movingInhabitants.clear();
+        log.End();
+        return false;
+    }
+
+    system->turnCount = turn;
+    system->movementProgress = 0;
+    system->turnInProgress = true;
+    return true;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdio>
+#include <vector>
+
+#include "gametypes.h"
+#include "inhabitant.h"
+#include "movelog.h"
+
+
+// Plays a recorded move log back into an InhabitantSystem instead of
+// simulating. Seeking restores the keyframe at or before the target and
+// applies at most a keyframe interval of logged turns on top, however
+// long the run. Normal playback starts logged turns like StartNextTurn
+// does, so UpdateCellMovement animates them as usual.
+struct MoveReplay
+{
+    MoveLogReader log = {};
+
+    FILE* keys = nullptr;
+    KeyframeHeader keyHeader = {};
+    u64 keyframeCount = 0;
+
+    // Every inhabitant's archetype, as stored once in the keyframes
+    std::vector<ArchetypeIndex> archetypes = {};
+
+    // Archetypes the replaying system needs at least
+    size_t archetypeCount = 0;
+
+    std::vector<LoggedMove> moves = {};
+
+    // Opens PATH and PATH.keys as written by MoveRecorder
+    static
+    bool Open(const char* path, MoveReplay* replay);
+
+    void Close();
+
+    inline
+    u64 FirstTurn() const
+    {
+        return keyHeader.firstTurn;
+    }
+
+    // Replaces *system with a fresh one, made from its settings, standing
+    // as the recording did after turn. Stops early at the end of the log.
+    // The system's dimensions must match the recording's
+    bool Seek(u64 turn, InhabitantSystem* system);
+
+    // Starts the turn logged after the system's current one, false at the
+    // end of the log. The system has to have been seeked by this replay
+    bool StartNextTurn(InhabitantSystem* system);
+
+    u64 KeyframeOffset(u64 keyframe) const;
+
+    // Reads the keyframe into a fresh system's store and cells, false if
+    // it's cut short or doesn't fit the log and the world
+    bool LoadKeyframe(u64 keyframe,
+                      InhabitantSystem* system,
+                      KeyframeRecord* record);
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cassert>
+
+#include "gametypes.h"
+
+
+// Philox4x32-10, the counter based generator from Salmon et al.,
+// "Parallel Random Numbers: As Easy as 1, 2, 3". Output is a pure
+// function of a 64 bit key and a 128 bit counter, there is no state to
+// share, so any thread can draw any number of any stream at any time.
+struct PhiloxBlock
+{
+    u32 words[4];
+};
+
+inline
+PhiloxBlock Philox4x32(u64 key, PhiloxBlock counter)
+{
+    constexpr u32 multiplier0 = 0xD2511F53;
+    constexpr u32 multiplier1 = 0xCD9E8D57;
+    constexpr u32 weyl0 = 0x9E3779B9;
+    constexpr u32 weyl1 = 0xBB67AE85;
+
+    u32 key0 = (u32)key;
+    u32 key1 = (u32)(key >> 32);
+
+    u32* c = counter.words;
+    for (int round = 0; round < 10; round++)
+    {
+        u64 product0 = (u64)multiplier0 * c[0];
+        u64 product1 = (u64)multiplier1 * c[2];
+
+        counter = {
+            (u32)(product1 >> 32) ^ c[1] ^ key0,
+            (u32)product1,
+            (u32)(product0 >> 32) ^ c[3] ^ key1,
+            (u32)product0,
+        };
+
+        key0 += weyl0;
+        key1 += weyl1;
+    }
+
+    return counter;
+}
+
+// Streams are keyed by turn, setup steps use streams no turn reaches
+constexpr u64 gTerrainStream = ~0ull;
+constexpr u64 gPopulateStream = ~0ull - 1;
+constexpr u64 gArchetypeStream = ~0ull - 2;
+
+// The numbers drawn for one cell in one stream. Blocks are only
+// generated once a number is asked for, so an unused stream is free.
+struct RandomStream
+{
+    u64 seed = 0;
+    u64 stream = 0;
+    u32 cell = 0;
+
+    u32 block = 0;
+    u32 used = 4;
+    PhiloxBlock buffered = {};
+
+    static
+    RandomStream Create(u64 seed, u64 stream, u32 cell)
+    {
+        return {
+            .seed = seed,
+            .stream = stream,
+            .cell = cell,
+        };
+    }
+
+    inline
+    u32 Next()
+    {
+        if (used == 4)
+        {
+            buffered = Philox4x32(seed, { cell,
+                                          (u32)stream,
+                                          (u32)(stream >> 32),
+                                          block++ });
+            used = 0;
+        }
+        return buffered.words[used++];
+    }
+
+    // Skips ahead, Next then returns the stream's nth number (from 0)
+    inline
+    void Seek(u64 n)
+    {
+        assert(n / 4 <= 0xffffffffull);
+
+        block = (u32)(n / 4);
+        used = 4;
+        if (n % 4 != 0)
+        {
+            Next();
+            used = n % 4;
+        }
+    }
+
+    // Uniform in [0, 1), from the next two numbers
+    inline
+    f64 NextUnit()
+    {
+        u64 high = Next();
+        u64 bits = (high << 32) | Next();
+        return (bits >> 11) * 0x1.0p-53;
+    }
+};
+
+// First number of a cell's stream, for when one draw is all it needs
+inline
+u32 RandomAt(u64 seed, u64 stream, u32 cell)
+{
+    return RandomStream::Create(seed, stream, cell).Next();
+}
+
+// SplitMix64 finaliser, a cheap well mixed hash of a 64 bit value
+inline
+u64 Mix64(u64 x)
+{
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// Key of the numbers drawn per inhabitant rather than per cell (the
+// asynchronous visiting order). Counters are the turn's stream and the
+// id, under its own key inhabitant i and cell i draw different numbers
+inline
+u64 InhabitantKey(u64 seed)
+{
+    return Mix64(seed ^ 0x9E3779B97F4A7C15ull);
+}
+
+// Key of the continuous time engine's numbers, event k draws from stream
+// k of it
+inline
+u64 EventKey(u64 seed)
+{
+    return Mix64(seed ^ 0xBF58476D1CE4E5B9ull);
+}
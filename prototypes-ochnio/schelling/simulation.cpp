@@ -0,0 +1,47 @@
+#include "simulation.h"
+
+#include <cassert>
+#include <cstdio>
+
+std::shared_ptr<const World>
+SimulationContext::CreateWorld(const SimulationSettings& settings)
+{
+    std::shared_ptr<World> world =
+        std::make_shared<World>(World::Create(settings.world));
+
+    const InhabitantsSettings& is = settings.inhabitants;
+    if (!is.pageFile.empty()
+        && !world->Page(is.pageFile.c_str(), is.PagedCapacity()))
+    {
+        fprintf(stderr, "keeping terrain in memory\n");
+    }
+
+    world->Randomize(settings.seed);
+    return world;
+}
+
+SimulationContext
+SimulationContext::Create(const SimulationSettings& settings)
+{
+    return Create(settings, CreateWorld(settings));
+}
+
+SimulationContext
+SimulationContext::Create(const SimulationSettings& settings,
+                          std::shared_ptr<const World> world)
+{
+    assert(world);
+    assert(world->dimensions.x == settings.inhabitants.size
+           && world->dimensions.y == settings.inhabitants.size);
+
+    SimulationContext context = {
+        .settings = settings,
+        .world = std::move(world),
+        .inhabitants = InhabitantSystem::Create(settings.inhabitants,
+                                                settings.seed),
+    };
+
+    context.inhabitants.Populate();
+
+    return context;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <memory>
+
+#include "gametypes.h"
+#include "world.h"
+#include "inhabitant.h"
+
+
+struct SimulationSettings
+{
+    WorldSettings world = {};
+    InhabitantsSettings inhabitants = {};
+
+    // Keys every random number of the simulation, terrain included
+    u64 seed = 0;
+};
+
+// Everything one simulation needs, passed around explicitly so any
+// number of them can live side by side in one process. The generator is
+// counter based, the seed is all the random state there is.
+struct SimulationContext
+{
+    SimulationSettings settings = {};
+
+    // Terrain never changes once generated, contexts made from the same
+    // one share it
+    std::shared_ptr<const World> world = {};
+
+    InhabitantSystem inhabitants = {};
+
+    // Generates terrain from settings.seed
+    static
+    SimulationContext Create(const SimulationSettings& settings);
+
+    // Shares already generated terrain of matching size
+    static
+    SimulationContext Create(const SimulationSettings& settings,
+                             std::shared_ptr<const World> world);
+
+    static
+    std::shared_ptr<const World> CreateWorld(const SimulationSettings& settings);
+};
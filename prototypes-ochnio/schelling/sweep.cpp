@@ -0,0 +1,531 @@
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <string>
+
+#include "gametypes.h"
+#include "gamesettings.h"
+#include "simulation.h"
+#include "threadpool.h"
+#include "clusters.h"
+
+// Runs every combination of a set of parameter values, dozens of seeds
+// each, as independent single threaded simulations spread over all cores.
+// One summary row per run is appended to the output as soon as it ends.
+//
+// The spec is a text file of "key value value ..." lines, # starts a
+// comment. Numeric values may be given as first:last:step ranges, but
+// seeds, first-seed, turns and cycle-window take one whole number each.
+//   intolerance   0.05:0.3:0.05
+//   density       0.5 0.7 0.9
+//   size          64 128
+//   archetypes    2 3 5
+//   seeds         20          runs seeds first-seed .. first-seed + 19
+//   first-seed    1
+//   turns         5000        RunUntilConverged limit
+//   movement      adjacent | global | best
+//   threshold     0.0
+//   settled       -1
+//   cycle-window  8
+
+struct SweepSpec
+{
+    std::vector<f32> intolerance = {};
+    std::vector<f32> density = {};
+    std::vector<f32> size = {};
+    std::vector<f32> archetypes = {};
+
+    u64 seeds = 1;
+    u64 firstSeed = 1;
+    u64 turns = 1000;
+
+    InhabitantsSettings base = {};
+};
+
+struct SweepRun
+{
+    u64 index = 0;
+    u64 seed = 0;
+    InhabitantsSettings settings = {};
+};
+
+static void PrintUsage(const char* program)
+{
+    printf("usage: %s --spec FILE [options]\n"
+           "  --spec FILE       sweep spec, see the top of sweep.cpp\n"
+           "  --out FILE        summary rows (default stdout)\n"
+           "  --threads N       simulations run at once (default all cores)\n",
+           program);
+}
+
+// "a b c" or "first:last:step", appended to values
+static bool ParseValues(char* text, std::vector<f32>* values)
+{
+    for (char* token = strtok(text, " \t\r\n");
+         token;
+         token = strtok(nullptr, " \t\r\n"))
+    {
+        f32 first = 0.0f;
+        f32 last = 0.0f;
+        f32 step = 0.0f;
+
+        if (sscanf(token, "%f:%f:%f", &first, &last, &step) == 3)
+        {
+            if (step <= 0.0f || last < first)
+            {
+                return false;
+            }
+
+            // Counted rather than accumulated so the last value isn't
+            // lost to rounding, nor pushed past last by it
+            i32 count = (i32)floorf((last - first) / step + 0.5f) + 1;
+            for (i32 i = 0; i < count; i++)
+            {
+                values->push_back(std::min(first + i * step, last));
+            }
+        }
+        else
+        {
+            char* end = nullptr;
+            values->push_back(strtof(token, &end));
+            if (*end != '\0')
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// Exactly one whole number in [min, max], no sign, fraction or range
+static bool ParseCount(char* text, u64 min, u64 max, u64* value)
+{
+    char* token = strtok(text, " \t\r\n");
+    if (!token || strtok(nullptr, " \t\r\n") || !isdigit((u8)token[0]))
+    {
+        return false;
+    }
+
+    errno = 0;
+    char* end = nullptr;
+    u64 parsed = strtoull(token, &end, 10);
+    if (*end != '\0' || errno == ERANGE || parsed < min || parsed > max)
+    {
+        return false;
+    }
+
+    *value = parsed;
+    return true;
+}
+
+// Every value a whole number in [min, max]
+static bool WholeInRange(const std::vector<f32>& values, f32 min, f32 max)
+{
+    for (f32 value : values)
+    {
+        if (!(value >= min && value <= max) || value != floorf(value))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Every value a fraction of the cells that leaves some inhabited
+static bool DensitiesInRange(const std::vector<f32>& values)
+{
+    for (f32 value : values)
+    {
+        if (!(value > 0.0f && value <= 1.0f))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool ParseSpec(const char* path, SweepSpec* spec)
+{
+    FILE* file = fopen(path, "r");
+    if (!file)
+    {
+        fprintf(stderr, "can't open spec %s\n", path);
+        return false;
+    }
+
+    InhabitantsSettings& base = spec->base;
+
+    char line[1024];
+    int lineNumber = 0;
+    bool ok = true;
+
+    while (ok && fgets(line, sizeof(line), file))
+    {
+        lineNumber++;
+
+        if (char* comment = strchr(line, '#'))
+        {
+            *comment = '\0';
+        }
+
+        char key[64];
+        int consumed = 0;
+        if (sscanf(line, " %63s%n", key, &consumed) != 1)
+        {
+            continue;
+        }
+
+        char* rest = line + consumed;
+        std::vector<f32> values = {};
+
+        if (strcmp(key, "movement") == 0)
+        {
+            char name[64] = {};
+            sscanf(rest, " %63s", name);
+
+            if (strcmp(name, "adjacent") == 0)
+            {
+                base.movementMode = EMovementMode::Adjacent;
+            }
+            else if (strcmp(name, "global") == 0)
+            {
+                base.movementMode = EMovementMode::Global;
+            }
+            else if (strcmp(name, "best") == 0)
+            {
+                base.movementMode = EMovementMode::BestVacancy;
+            }
+            else
+            {
+                ok = false;
+            }
+            continue;
+        }
+
+        // Counts are taken as they are, never through a float
+        if (strcmp(key, "seeds") == 0)
+        {
+            ok = ParseCount(rest, 1, UINT64_MAX, &spec->seeds);
+            continue;
+        }
+        if (strcmp(key, "first-seed") == 0)
+        {
+            ok = ParseCount(rest, 0, UINT64_MAX, &spec->firstSeed);
+            continue;
+        }
+        if (strcmp(key, "turns") == 0)
+        {
+            ok = ParseCount(rest, 0, UINT64_MAX, &spec->turns);
+            continue;
+        }
+        if (strcmp(key, "cycle-window") == 0)
+        {
+            u64 window = 0;
+            ok = ParseCount(rest, 0, gMaxCycleWindow, &window);
+            base.convergence.cycleWindow = (u32)window;
+            continue;
+        }
+
+        if (!ParseValues(rest, &values) || values.empty())
+        {
+            ok = false;
+        }
+        else if (strcmp(key, "intolerance") == 0)
+        {
+            spec->intolerance = values;
+        }
+        else if (strcmp(key, "density") == 0)
+        {
+            spec->density = values;
+            ok = DensitiesInRange(values);
+        }
+        else if (strcmp(key, "size") == 0)
+        {
+            spec->size = values;
+            ok = WholeInRange(values, 1.0f, (f32)gMaxWorldSize);
+        }
+        else if (strcmp(key, "archetypes") == 0)
+        {
+            spec->archetypes = values;
+            ok = WholeInRange(values, 1.0f, (f32)gMaxArchetypes);
+        }
+        else if (strcmp(key, "threshold") == 0)
+        {
+            base.gHappinessThreshold = values[0];
+        }
+        else if (strcmp(key, "settled") == 0)
+        {
+            base.convergence.settledFraction = values[0];
+        }
+        else
+        {
+            ok = false;
+        }
+    }
+
+    if (!ok)
+    {
+        fprintf(stderr, "%s:%d: bad spec line\n", path, lineNumber);
+    }
+
+    fclose(file);
+    return ok;
+}
+
+// Every combination of the swept values, false if one of them has more
+// inhabitants than a cell can hold ids for, or more cells than clusters
+// can be labelled in
+static bool ExpandRuns(const SweepSpec& spec, std::vector<SweepRun>* runs)
+{
+    const InhabitantsSettings& base = spec.base;
+
+    // Unswept parameters keep the default
+    auto orDefault = [](const std::vector<f32>& values, f32 fallback)
+    {
+        return values.empty() ? std::vector<f32>{ fallback } : values;
+    };
+
+    std::vector<f32> intolerance = orDefault(spec.intolerance,
+                                             base.gIntoleranceFactor);
+    std::vector<f32> density = orDefault(spec.density, base.gMaxInhabitants);
+    std::vector<f32> size = orDefault(spec.size, (f32)base.size);
+    std::vector<f32> archetypes = orDefault(spec.archetypes,
+                                            (f32)base.archetypes.size());
+
+    for (f32 s : size)
+    {
+        // Every run ends by labelling its clusters
+        if ((size_t)s * (size_t)s >= gMaxClusterCells)
+        {
+            fprintf(stderr, "size %zu has too many cells to label "
+                            "clusters in\n", (size_t)s);
+            return false;
+        }
+    }
+
+    for (f32 s : size)
+    for (f32 d : density)
+    {
+        size_t side = (size_t)s;
+        if ((size_t)(side * side * d) > gMaxCellInhabitants)
+        {
+            fprintf(stderr, "size %zu at density %g needs more ids than "
+                            "a cell holds\n", side, d);
+            return false;
+        }
+    }
+
+    for (f32 s : size)
+    for (f32 k : archetypes)
+    for (f32 d : density)
+    for (f32 f : intolerance)
+    for (u64 seed = 0; seed < spec.seeds; seed++)
+    {
+        InhabitantsSettings settings = base;
+        settings.size = (size_t)s;
+        settings.gMaxInhabitants = d;
+        settings.gIntoleranceFactor = f;
+        settings.SetArchetypeCount((size_t)k);
+
+        runs->push_back({ .index = runs->size(),
+                          .seed = spec.firstSeed + seed,
+                          .settings = settings });
+    }
+
+    return true;
+}
+
+static SimulationSettings RunSettings(const SweepRun& run)
+{
+    return {
+        .world = { .size = (int)run.settings.size },
+        .inhabitants = run.settings,
+        .seed = run.seed,
+    };
+}
+
+int main(int argc, const char** argv)
+{
+    const char* specPath = nullptr;
+    const char* outPath = nullptr;
+    u32 threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (int i = 1; i < argc; i++)
+    {
+        const char* arg = argv[i];
+        bool hasValue = i + 1 < argc;
+
+        if (strcmp(arg, "--spec") == 0 && hasValue)
+        {
+            specPath = argv[++i];
+        }
+        else if (strcmp(arg, "--out") == 0 && hasValue)
+        {
+            outPath = argv[++i];
+        }
+        else if (strcmp(arg, "--threads") == 0 && hasValue)
+        {
+            threads = std::max(1, atoi(argv[++i]));
+        }
+        else
+        {
+            PrintUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (!specPath)
+    {
+        PrintUsage(argv[0]);
+        return 1;
+    }
+
+    SweepSpec spec = {};
+    spec.base = GameSettings::Defaults().inhabitants;
+
+    // Runs are spread over the cores, each one stays single threaded
+    spec.base.threadCount = 1;
+
+    if (!ParseSpec(specPath, &spec))
+    {
+        return 1;
+    }
+
+    std::vector<SweepRun> runs = {};
+    if (!ExpandRuns(spec, &runs))
+    {
+        return 1;
+    }
+
+    // Terrain is the same for every run of a size, generated once and
+    // shared read only. Its seed doesn't matter to the inhabitants
+    std::map<size_t, std::shared_ptr<const World>> worlds = {};
+    for (SweepRun& run : runs)
+    {
+        std::shared_ptr<const World>& world = worlds[run.settings.size];
+        if (!world)
+        {
+            world = SimulationContext::CreateWorld(RunSettings(run));
+        }
+    }
+
+    FILE* out = outPath ? fopen(outPath, "w") : stdout;
+    if (!out)
+    {
+        fprintf(stderr, "can't open %s\n", outPath);
+        return 1;
+    }
+
+    fprintf(out, "run\tseed\tsize\tdensity\tintolerance\tarchetypes"
+                 "\tinhabitants\tturns\tstopped\ttotal_moves"
+                 "\tunhappy\tdissimilarity\tmixed_boundary\tclusters"
+                 "\tlargest_cluster\tseconds\n");
+    fflush(out);
+
+    std::mutex outMutex;
+
+    // The calling thread is one of the runners
+    std::shared_ptr<ThreadPool> pool = threads > 1
+                                        ? ThreadPool::Create(threads - 1)
+                                        : nullptr;
+
+    auto runOne = [&](size_t index, u32)
+    {
+        SweepRun& run = runs[index];
+
+        auto start = std::chrono::steady_clock::now();
+
+        SimulationContext context =
+            SimulationContext::Create(RunSettings(run),
+                                      worlds.at(run.settings.size));
+        InhabitantSystem& system = context.inhabitants;
+
+        ConvergenceResult result = system.RunUntilConverged(spec.turns);
+
+        // Only the final metrics are reported, counting them once is
+        // cheaper than keeping them up to date through every move
+        system.metrics =
+            SegregationMetrics::Create(system.dimensions,
+                                       system.settings.archetypes.size());
+        system.RecountMetrics();
+
+        u64 totalMoves = 0;
+        for (u64 moves : system.convergence.movesPerTurn)
+        {
+            totalMoves += moves;
+        }
+
+        SegregationMetrics& metrics = system.metrics;
+        u64 inhabitants = system.inhabitants.Count();
+        f64 unhappy = 1.0 - metrics.HappyFraction();
+
+        ClusterStats clusters = ClusterStats::Compute(&system,
+                                                      EConnectivity::Four);
+        u64 largestCluster = 0;
+        for (u64 largest : clusters.largest)
+        {
+            largestCluster = std::max(largestCluster, largest);
+        }
+
+        f64 seconds = std::chrono::duration<f64>(
+                        std::chrono::steady_clock::now() - start).count();
+
+        std::lock_guard<std::mutex> lock(outMutex);
+        fprintf(out, "%llu\t%llu\t%zu\t%g\t%g\t%zu\t%llu\t%llu\t%s\t%llu"
+                     "\t%.6f\t%.6f\t%llu\t%zu\t%llu\t%.3f\n",
+                (unsigned long long)run.index,
+                (unsigned long long)run.seed,
+                run.settings.size,
+                run.settings.gMaxInhabitants,
+                run.settings.gIntoleranceFactor,
+                run.settings.archetypes.size(),
+                (unsigned long long)inhabitants,
+                (unsigned long long)result.turns,
+                StopReasonName(result.reason),
+                (unsigned long long)totalMoves,
+                unhappy,
+                metrics.Dissimilarity(),
+                (unsigned long long)metrics.MixedBoundary(),
+                clusters.sizes.size(),
+                (unsigned long long)largestCluster,
+                seconds);
+        fflush(out);
+    };
+
+    auto sweepStart = std::chrono::steady_clock::now();
+
+    if (pool)
+    {
+        pool->ParallelFor(runs.size(), runOne);
+    }
+    else
+    {
+        for (size_t i = 0; i < runs.size(); i++)
+        {
+            runOne(i, 0);
+        }
+    }
+
+    f64 sweepSeconds = std::chrono::duration<f64>(
+                        std::chrono::steady_clock::now() - sweepStart).count();
+
+    fprintf(stderr, "%zu runs on %u threads in %.3f s\n",
+            runs.size(), threads, sweepSeconds);
+
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+
+    return 0;
+}
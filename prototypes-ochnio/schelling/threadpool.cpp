@@ -0,0 +1,139 @@
+#include "threadpool.h"
+
+#include <atomic>
+#include <cassert>
+
+std::shared_ptr<ThreadPool>
+ThreadPool::Create(u32 threadCount)
+{
+    assert(threadCount > 0);
+
+    std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>();
+
+    for (u32 i = 0; i < threadCount; i++)
+    {
+        pool->workers.emplace_back([p = pool.get()] { p->WorkerLoop(); });
+    }
+
+    return pool;
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+
+    for (std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::WorkerLoop()
+{
+    while (true)
+    {
+        std::function<void()> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+
+            if (jobs.empty())
+            {
+                return;
+            }
+
+            job = std::move(jobs.front());
+            jobs.pop_front();
+            running++;
+        }
+
+        job();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running--;
+            if (jobs.empty() && running == 0)
+            {
+                idle.notify_all();
+            }
+        }
+    }
+}
+
+void ThreadPool::Submit(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push_back(std::move(job));
+    }
+    wake.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [this] { return jobs.empty() && running == 0; });
+}
+
+struct ParallelForState
+{
+    std::atomic<size_t> next = 0;
+    std::atomic<size_t> completed = 0;
+    size_t count = 0;
+
+    const std::function<void(size_t, u32)>* fn = nullptr;
+
+    std::mutex mutex;
+    std::condition_variable done;
+
+    // Returns true when this call finished the last index
+    bool Run(u32 slot)
+    {
+        size_t finished = 0;
+        for (size_t i = next++; i < count; i = next++)
+        {
+            (*fn)(i, slot);
+            finished++;
+        }
+
+        return finished > 0
+            && completed.fetch_add(finished) + finished == count;
+    }
+};
+
+void ThreadPool::ParallelFor(size_t count,
+                const std::function<void(size_t index, u32 slot)>& fn)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    // Jobs may still be dequeued after we return, they find no indices
+    // left and only touch the shared state
+    std::shared_ptr<ParallelForState> state =
+                            std::make_shared<ParallelForState>();
+    state->count = count;
+    state->fn = &fn;
+
+    u32 helpers = std::min<size_t>(ThreadCount(), count - 1);
+    for (u32 slot = 0; slot < helpers; slot++)
+    {
+        Submit([state, slot] {
+            if (state->Run(slot))
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->done.notify_all();
+            }
+        });
+    }
+
+    state->Run(ThreadCount());
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->done.wait(lock, [&] { return state->completed == count; });
+}
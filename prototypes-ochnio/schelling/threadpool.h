@@ -0,0 +1,54 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+
+#include "gametypes.h"
+
+
+// Fixed set of worker threads fed from one job queue.
+// Created once and shared, threads are not spawned per turn.
+struct ThreadPool
+{
+    std::vector<std::thread> workers = {};
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable idle;
+
+    std::deque<std::function<void()>> jobs = {};
+    size_t running = 0;
+    bool stopping = false;
+
+    static
+    std::shared_ptr<ThreadPool> Create(u32 threadCount);
+
+    ~ThreadPool();
+
+    inline
+    u32 ThreadCount()
+    {
+        return workers.size();
+    }
+
+    // Queue a job, returns immediately
+    void Submit(std::function<void()> job);
+
+    // Blocks until every submitted job has finished
+    void Wait();
+
+    // Calls fn(index, slot) for every index in [0, count) and returns once
+    // all of them are done. The calling thread works too. slot is in
+    // [0, ThreadCount()] and never used by two threads at once within one
+    // call, so it can pick per thread scratch space.
+    // Safe to call from inside a job, it never waits on queued work.
+    void ParallelFor(size_t count,
+                     const std::function<void(size_t index, u32 slot)>& fn);
+
+    void WorkerLoop();
+};
@@ -1,8 +1,12 @@
 #pragma once 
 
 #include "raylib.h"
+#include "raymath.h"
 #include "gametypes.h"
 
+#include <array>
+#include <math.h>
+
 template <typename T, size_t R, size_t C>
 using matrix = std::array<std::array<T, C>, R>;
 
@@ -14,4 +18,26 @@ inline bool ColorEqual(Color a, Color b)
     return ca == cb;
 }
 
+inline Color ToColor(RGBA8 c)
+{
+    return { c.r, c.g, c.b, c.a };
+}
 
+inline
+bool RayIntersectionPlane(Ray ray, Vector3 planeNormal, Vector3* outPosition)
+{
+    bool hit = false;
+
+    float denom = Vector3DotProduct(planeNormal, ray.direction);
+    if (fabs(denom) > 0.0001f)
+    {
+        float t = Vector3DotProduct(Vector3Subtract((Vector3){0,0,0}, ray.position), planeNormal) / denom;
+        if (t >= 0)
+        {
+            *outPosition = Vector3Add(ray.position, Vector3Scale(ray.direction, t));
+            hit = true;
+        }
+    }
+
+    return hit;
+}
@@ -0,0 +1,124 @@
+#include "vacancyindex.h"
+
+VacancyIndex
+VacancyIndex::Create(size_t cellCount, size_t archetypeCount)
+{
+    return {
+        .cellCount = cellCount,
+        .archetypeCount = archetypeCount,
+        .buckets = std::vector<std::vector<u32>>(archetypeCount
+                                                 * gVacancyBuckets),
+        .slotOf = std::vector<u32>(archetypeCount * cellCount, InvalidSlot),
+        .bucketOf = std::vector<u8>(archetypeCount * cellCount, 0),
+    };
+}
+
+void VacancyIndex::Set(u32 cell, ArchetypeIndex archetype, i32 net)
+{
+    assert(net >= -gVacancyBucketBias && net <= gVacancyBucketBias);
+
+    size_t at = archetype * cellCount + cell;
+    u8 bucket = net + gVacancyBucketBias;
+
+    if (slotOf[at] != InvalidSlot)
+    {
+        if (bucketOf[at] == bucket)
+        {
+            return;
+        }
+
+        // Swap remove from the old bucket
+        std::vector<u32>& old = buckets[archetype * gVacancyBuckets
+                                        + bucketOf[at]];
+        u32 last = old.back();
+        old[slotOf[at]] = last;
+        slotOf[archetype * cellCount + last] = slotOf[at];
+        old.pop_back();
+    }
+
+    std::vector<u32>& members = buckets[archetype * gVacancyBuckets + bucket];
+    slotOf[at] = members.size();
+    bucketOf[at] = bucket;
+    members.push_back(cell);
+}
+
+void VacancyIndex::Remove(u32 cell)
+{
+    assert(Contains(cell));
+
+    for (size_t a = 0; a < archetypeCount; a++)
+    {
+        size_t at = a * cellCount + cell;
+
+        std::vector<u32>& members = buckets[a * gVacancyBuckets
+                                            + bucketOf[at]];
+        u32 last = members.back();
+        members[slotOf[at]] = last;
+        slotOf[a * cellCount + last] = slotOf[at];
+        members.pop_back();
+
+        slotOf[at] = InvalidSlot;
+    }
+}
+
+bool VacancyIndex::Reorder(const u32* sizes,
+                           const u32* cells,
+                           size_t cellsGiven)
+{
+    size_t total = 0;
+    for (size_t b = 0; b < buckets.size(); b++)
+    {
+        if (sizes[b] != buckets[b].size())
+        {
+            return false;
+        }
+        total += sizes[b];
+    }
+
+    if (total != cellsGiven)
+    {
+        return false;
+    }
+
+    for (size_t b = 0; b < buckets.size(); b++)
+    {
+        size_t archetype = b / gVacancyBuckets;
+        u8 bucket = b % gVacancyBuckets;
+        std::vector<u32>& members = buckets[b];
+
+        // Taken out as they're seen, a repeat or a stranger isn't there
+        for (size_t i = 0; i < members.size(); i++)
+        {
+            u32 cell = cells[i];
+            size_t at = archetype * cellCount + cell;
+            if (cell >= cellCount
+                || slotOf[at] == InvalidSlot
+                || bucketOf[at] != bucket)
+            {
+                return false;
+            }
+            slotOf[at] = InvalidSlot;
+        }
+
+        for (size_t i = 0; i < members.size(); i++)
+        {
+            members[i] = cells[i];
+            slotOf[archetype * cellCount + cells[i]] = i;
+        }
+        cells += members.size();
+    }
+
+    return true;
+}
+
+i32 VacancyIndex::BestNet(ArchetypeIndex archetype, i32 atMost)
+{
+    for (i32 net = atMost; net >= -gVacancyBucketBias; net--)
+    {
+        if (!Bucket(archetype, net).empty())
+        {
+            return net;
+        }
+    }
+    return i32Min;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <vector>
+#include <cassert>
+
+#include "gametypes.h"
+#include "inhabitantstore.h"
+#include "cellset.h"
+
+
+// Net scores range over [-gNeighbourCount, gNeighbourCount]
+constexpr i32 gVacancyBuckets = 9;
+constexpr i32 gVacancyBucketBias = 4;
+
+// Empty and unclaimed cells bucketed by the net score they offer each
+// archetype. Every vacancy sits in exactly one bucket per archetype, so
+// moving it between buckets or dropping it is O(1), and the best bucket
+// is found by looking at gVacancyBuckets sizes.
+struct VacancyIndex
+{
+    size_t cellCount = 0;
+    size_t archetypeCount = 0;
+
+    // [archetype][bucket], packed cell indices
+    std::vector<std::vector<u32>> buckets = {};
+
+    // [archetype][cell], slot within the cell's bucket, InvalidSlot when
+    // the cell is not a vacancy
+    std::vector<u32> slotOf = {};
+
+    // [archetype][cell], meaningless when the cell is not a vacancy
+    std::vector<u8> bucketOf = {};
+
+    static
+    VacancyIndex Create(size_t cellCount, size_t archetypeCount);
+
+    inline
+    bool Contains(u32 cell)
+    {
+        return slotOf[cell] != InvalidSlot;
+    }
+
+    inline
+    i32 NetOf(u32 cell, ArchetypeIndex archetype)
+    {
+        assert(Contains(cell));
+        return (i32)bucketOf[archetype * cellCount + cell] - gVacancyBucketBias;
+    }
+
+    inline
+    std::vector<u32>& Bucket(ArchetypeIndex archetype, i32 net)
+    {
+        return buckets[archetype * gVacancyBuckets + net + gVacancyBucketBias];
+    }
+
+    // Files cell under net for archetype, adding it if it's new.
+    // A cell joins the index once it's been set for every archetype.
+    void Set(u32 cell, ArchetypeIndex archetype, i32 net);
+
+    // Drops cell from every archetype's buckets
+    void Remove(u32 cell);
+
+    // Puts every bucket's cells in the given order: sizes holds the
+    // bucket sizes [archetype][bucket], cells the buckets one after the
+    // other. Every bucket has to hold the same cells as it does now.
+    // False otherwise, leaving the index broken
+    bool Reorder(const u32* sizes, const u32* cells, size_t cellsGiven);
+
+    // Highest net up to atMost with at least one vacancy for archetype,
+    // i32Min when there is none
+    i32 BestNet(ArchetypeIndex archetype, i32 atMost = gVacancyBucketBias);
+};
@@ -2,48 +2,57 @@
 #include <cstdio>
 #include <cstdint>
 
-#include "raylib.h"
 #include "world.h"
-#include "gamesettings.h"
+#include "rng.h"
 
-World World::Create()
+World World::Create(const WorldSettings& settings)
 {
 
-    WorldSettings& settings = GameSettings::worldSettings;
+    V2<size_t> dimensions = { (size_t)settings.size,
+                              (size_t)settings.size };
 
     return {
-        .dimensions = { (size_t)settings.size, 
-                        (size_t)settings.size },
-
-        .tiles = std::vector<GroundTile>(settings.size 
-                                        * settings.size)
+        .dimensions = dimensions,
+        .tiles = ChunkedGrid<GroundTile>::Create(dimensions),
     };
 };
 
-void World::Randomize()
+bool World::Page(const char* path, size_t capacity)
 {
-    WorldSettings& settings = GameSettings::worldSettings;
+    return tiles.Page(path, capacity);
+};
 
-    for (int i = 0; i < settings.size; ++i)
-    for (int j = 0; j < settings.size; ++j)
+void World::Randomize(u64 seed)
+{
+    // Row major, the order tiles are paged in
+    for (int j = 0; j < (int)dimensions.y; ++j)
+    for (int i = 0; i < (int)dimensions.x; ++i)
     {
         ETileTypes tileType = 
-                            (ETileTypes)((int)rand() 
+                            (ETileTypes)(RandomAt(seed,
+                                                  gTerrainStream,
+                                                  Index(i, j))
                             % (int)ETileTypes::Count);
         SetTile(i, j, { tileType });
     }
 };
 
 
-GroundTile& World::GetTile(int x, int y)
+size_t World::Index(int x, int y) const
+{
+    return (y * dimensions.x) + x;
+};
+
+
+GroundTile World::GetTile(int x, int y) const
 { 
-    return tiles[(y * dimensions.x) + x];
+    return tiles.Get(x, y);
 };
 
 
 void World::SetTile(int x, int y, GroundTile tile)
 {
-    tiles[(y * dimensions.x) + x] = tile;
+    tiles.Set(x, y, tile);
 };
 
 
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <vector>
+#include "gametypes.h"
 #include "math.h"
+#include "chunkedgrid.h"
 
 
 enum class ETileTypes
@@ -26,15 +28,20 @@ struct WorldSettings
 struct World
 {
     V2<size_t> dimensions;
-    std::vector<GroundTile> tiles;
 
-    static World Create();
+    // Chunked the same way as InhabitantSystem::cells
+    ChunkedGrid<GroundTile> tiles;
 
-    void Randomize();
+    static World Create(const WorldSettings& settings);
 
-    size_t Index(int x, int y);
+    // Moves the tiles into a file, see ChunkedGrid::Page
+    bool Page(const char* path, size_t capacity);
+
+    void Randomize(u64 seed);
+
+    size_t Index(int x, int y) const;
                     
-    GroundTile& GetTile(int x, int y);
+    GroundTile GetTile(int x, int y) const;
 
     void SetTile(int x, int y, GroundTile tile);
 };
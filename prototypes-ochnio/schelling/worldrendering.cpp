@@ -1,6 +1,6 @@
 #include "worldrendering.h"
 
-void WorldDrawSystem::DrawWorld( World* world, AABB<i32> cullingBox)
+void WorldDrawSystem::DrawWorld( const World* world, AABB<i32> cullingBox)
 {
 
     for (int i = cullingBox.xMin; i < cullingBox.xMax; ++i)
@@ -24,7 +24,7 @@ struct WorldDrawSystem
 
 
 
-    void DrawWorld( World* world, AABB<i32> cullingBox);
+    void DrawWorld( const World* world, AABB<i32> cullingBox);
     
     void HighlightCellAtPosition(V2<i32> position);
     void ResetHighlight();